@@ -1,4 +1,5 @@
 #include <poll.h> // POLL* constants
+#include <ctype.h> // tolower
 #include <time.h> // clock_gettime
 #include <iostream>
 #include <vector>
@@ -7,33 +8,65 @@
 #include <thread>
 #include <mutex>
 #include <functional>
+#include <algorithm>
 
 #include "backend.hpp"
 #include "common.hpp"
 #include "socket.hpp"
 #include "dns.hpp"
+#include "pcap.hpp"
+#include "trace.hpp"
 
 using MutexAutoLock = std::unique_lock<std::mutex>;
-static inline time_t clock_monotonic();
+static inline int64_t clock_monotonic_us();
+static inline MutexAutoLock lock_timed(std::mutex &m, Counter &wait_us);
 static inline ustring encode_u16(uint16_t v);
+static inline uint64_t mix64(uint64_t v);
+
+// points every resolver has on the hash ring, more even out the load
+#define AFFINITY_POINTS 64
+
+struct ConsensusGroup
+{
+	QueryID id;
+	unsigned attempts;
+	unsigned job;
+	unsigned copies; // number of resolvers it was sent to
+	unsigned outstanding; // copies still waiting for an answer
+	std::vector<std::pair<size_t, DNSPacket>> answers; // resolver, answer
+
+	ConsensusGroup(const QueueEntry &e, unsigned copies) :
+		id(e.id), attempts(e.attempts + 1), job(e.job), copies(copies), outstanding(copies) {}
+};
 
 struct PendingQuery
 {
 	QueryID id;
+	unsigned attempts;
+	unsigned job;
 	size_t resolver_id;
-	time_t time_sent;
+	int64_t time_sent;
+	ustring key;
+	// duplicate of this query sent by hedging, whichever answers first wins
+	PendingQuery *sibling = nullptr;
+	bool hedged = false;
+	// set if the same query was sent to multiple resolvers for a vote
+	ConsensusGroup *group = nullptr;
+
+	PendingQuery(const QueueEntry &e, size_t resolver_id, const ustring &key) :
+		id(e.id), attempts(e.attempts + 1), job(e.job), resolver_id(resolver_id), key(key) {
+		time_sent = clock_monotonic_us();
+	}
 
-	PendingQuery(QueryID id, size_t resolver_id) :
-		id(id), resolver_id(resolver_id) {
-		time_sent = clock_monotonic();
+	inline QueueEntry retryEntry() const {
+		return QueueEntry(id, attempts, resolver_id, job);
 	}
 };
 
 QueryBackend::QueryBackend(const std::vector<SocketAddress> &resolvers,
 	unsigned concurrent, time_t timeout, bool timeout_keep_cap)
-	: timeout(timeout), timeout_keep_cap(timeout_keep_cap)
+	: sock(new Socket()), concurrent(concurrent), timeout(timeout), timeout_keep_cap(timeout_keep_cap)
 {
-	this->resolvers.reserve(resolvers.size());
 	for(auto &addr : resolvers)
 		this->resolvers.emplace_back(Resolver(addr, concurrent));
 }
@@ -41,18 +74,85 @@ QueryBackend::QueryBackend(const std::vector<SocketAddress> &resolvers,
 void QueryBackend::setCallbacks(
 	std::function<DNSQuestion(QueryID)> callback_question,
 	std::function<void(const DNSPacket&, QueryID)> callback_answer,
-	std::function<void(QueryID)> callback_timeout)
+	std::function<void(QueryID)> callback_fail)
 {
 	this->callback_question = callback_question;
 	this->callback_answer = callback_answer;
-	this->callback_timeout = callback_timeout;
+	this->callback_fail = callback_fail;
+}
+
+void QueryBackend::setLocalCallback(std::function<bool(QueryID)> callback_local)
+{
+	this->callback_local = callback_local;
+}
+
+void QueryBackend::setRetryPolicy(const RetryPolicy &policy)
+{
+	retry_policy = policy;
 }
 
-void QueryBackend::queue(QueryID id)
+void QueryBackend::setHedgePolicy(const HedgePolicy &policy)
+{
+	hedge_policy = policy;
+}
+
+void QueryBackend::setAffinityPolicy(const AffinityPolicy &policy)
+{
+	affinity_policy = policy;
+}
+
+void QueryBackend::setConsensus(unsigned copies,
+	std::function<void(QueryID, unsigned, unsigned)> callback_conflict)
+{
+	consensus = copies;
+	this->callback_conflict = callback_conflict;
+}
+
+void QueryBackend::setRouteCallback(std::function<void(QueryID, std::vector<size_t>*)> callback_route)
+{
+	this->callback_route = callback_route;
+}
+
+void QueryBackend::setRecorder(PcapWriter *recorder)
+{
+	this->recorder = recorder;
+}
+
+void QueryBackend::setSocket(DatagramSocket *sock)
+{
+	this->sock.reset(sock);
+}
+
+void QueryBackend::setRecursionDesired(bool rd)
+{
+	recursion_desired = rd;
+}
+
+size_t QueryBackend::addResolver(const SocketAddress &addr)
+{
+	MutexAutoLock alock(mtx);
+
+	resolvers.emplace_back(Resolver(addr, concurrent));
+	return resolvers.size() - 1;
+}
+
+void QueryBackend::queue(QueryID id, unsigned job)
 {
 	MutexAutoLock alock(mtx);
 
-	send_queue.emplace_back(id);
+	send_queue.push(QueueEntry(id, 0, SIZE_MAX, job));
+}
+
+void QueryBackend::setSource(std::function<bool(QueryID*)> callback_source)
+{
+	this->callback_source = callback_source;
+}
+
+void QueryBackend::setJobWeight(unsigned job, unsigned weight)
+{
+	MutexAutoLock alock(mtx);
+
+	send_queue.setWeight(job, weight);
 }
 
 void QueryBackend::start()
@@ -60,6 +160,7 @@ void QueryBackend::start()
 	n_sent = n_recv = 0;
 	n_queue = send_queue.size();
 	should_exit = false;
+	local_port = sock->getLocalPort();
 
 	t_recv = new std::thread(&QueryBackend::recv_thread, this);
 	t_timeout = new std::thread(&QueryBackend::timeout_thread, this);
@@ -76,6 +177,23 @@ void QueryBackend::getStats(uint32_t *n_sent, uint32_t *n_queue, uint32_t *n_rec
 		*n_recv = reset ? this->n_recv.exchange(0) : this->n_recv.load();
 }
 
+void QueryBackend::getResolverStats(std::vector<ResolverStats> *stats)
+{
+	MutexAutoLock alock(mtx);
+	stats->resize(resolvers.size());
+	for(size_t i = 0; i < resolvers.size(); i++) {
+		const Resolver &r = resolvers[i];
+		ResolverStats &st = (*stats)[i];
+		st.addr = r.addr.toString(r.addr.getPort() != 53);
+		st.sent = r.n_sent;
+		st.received = r.n_recv;
+		st.timeouts = r.n_timeout;
+		st.errors = r.n_error;
+		st.rtt_sum_us = r.rtt_sum_us;
+		st.capacity = r.capacity;
+	}
+}
+
 void QueryBackend::stopJoin()
 {
 	should_exit = true;
@@ -83,7 +201,7 @@ void QueryBackend::stopJoin()
 	t_timeout->join();
 
 	// close the socket and wait for t_recv to exit
-	sock.close();
+	sock->close();
 	t_recv->join();
 
 	delete t_send;
@@ -98,45 +216,109 @@ void QueryBackend::recv_thread()
 	DNSPacket pkt;
 	SocketAddress src_addr;
 
+	TRACE_THREAD("recv");
 	while(1) {
 		{
-			short ev = sock.poll(POLLIN, 1000);
+			TRACE_SPAN("poll");
+			short ev = sock->poll(POLLIN, 1000);
 			if(ev == 0)
 				continue;
 			else if(ev & POLLNVAL)
 				break; // we're done here
 		}
-		sock.recvfrom(4096, &data, src_addr);
+		{
+			TRACE_SPAN("recvfrom");
+			sock->recvfrom(4096, &data, src_addr);
+		}
+		if(data.empty())
+			continue;
+		if(recorder) {
+			TRACE_SPAN("record");
+			recorder->write(data, src_addr, local_port, false);
+		}
 
 		try {
+			TRACE_SPAN("decode");
 			pkt.decode(data);
 		} catch(const DecodeException &e) {
 			std::cerr << "A packet failed to decode " << e.what() << std::endl;
+			metrics.decode_errors++;
 			continue;
 		} catch(const std::ios_base::failure &e) {
 			std::cerr << "A packet failed to decode (truncated)" << std::endl;
+			metrics.decode_errors++;
 			continue;
 		}
 
+		enum DNSRcode rcode = pkt.rcode();
+		bool is_error = retry_policy.retry_errors &&
+			(rcode == DNS_RCODE_SERVFAIL || rcode == DNS_RCODE_REFUSED);
+
 		PendingQuery *p;
-		const ustring key = src_addr.getIPBytes() + encode_u16(pkt.txid);
+		ConsensusGroup *group = nullptr;
+		bool drop = false;
+		const ustring key = src_addr.getIPBytes() + encode_u16(src_addr.getPort()) + encode_u16(pkt.txid);
+		const int64_t now = clock_monotonic_us();
 		{
-			MutexAutoLock alock(mtx);
+			MutexAutoLock alock = lock_timed(mtx, metrics.lock_wait_us);
+			TRACE_SPAN("match");
 			auto it = pending.find(key);
 			if(it == pending.end()) {
-				std::cerr << "Unexpected answer packet (late answer?)" << std::endl;
+				if(cancelled.erase(key) == 0)
+					std::cerr << "Unexpected answer packet (late answer?)" << std::endl;
+				metrics.late++;
 				continue;
 			}
 			p = it->second;
 			pending.erase(it);
 
-			resolvers[p->resolver_id].restoreCapacity();
-		}
+			Resolver &res = resolvers[p->resolver_id];
+			res.restoreCapacity();
+			unpark(p->resolver_id);
+			res.n_recv++;
+			res.n_error += is_error ? 1 : 0;
+			res.rtt_sum_us += now - p->time_sent;
+
+			if(p->sibling) {
+				PendingQuery *s = p->sibling;
+				if(is_error) {
+					// let the other copy continue in our place
+					s->sibling = nullptr;
+					drop = true;
+				} else {
+					// cancel the other copy
+					pending.erase(s->key);
+					resolvers[s->resolver_id].restoreCapacity();
+					unpark(s->resolver_id);
+					cancelled.emplace(s->key, s->time_sent);
+					delete s;
+				}
+			}
 
-		callback_answer(pkt, p->id);
-		delete p;
+			if(p->group) {
+				// collect the answer, the last one decides
+				if(!is_error)
+					p->group->answers.emplace_back(p->resolver_id, pkt);
+				if(--p->group->outstanding == 0)
+					group = p->group;
+			}
+		}
 
 		n_recv++;
+		metrics.received++;
+		metrics.rcodes[rcode]++;
+		metrics.rtt.add(now - p->time_sent);
+
+		if(p->group) {
+			if(group)
+				vote(group);
+		} else if(!is_error) {
+			TRACE_SPAN("answer callback");
+			callback_answer(pkt, p->id);
+		} else if(!drop) {
+			retry(p->retryEntry());
+		}
+		delete p;
 	}
 }
 
@@ -145,88 +327,297 @@ void QueryBackend::send_thread()
 	size_t resolver_id = 0;
 	DNSPacket pkt;
 	ustring data;
+	std::vector<size_t> chosen, route;
 
-	pkt.flags = 0x0100; // QUERY opcode, RD=1
+	pkt.flags = recursion_desired ? 0x0100 : 0; // QUERY opcode, RD
 
+	TRACE_THREAD("send");
 	do {
-		QueryID id = 0; // shut up gcc
+		QueueEntry e(0);
+		ustring hedge_key;
 		bool any;
 		{
 			MutexAutoLock alock(mtx);
-			any = !send_queue.empty();
-			if(any) {
-				id = send_queue.front();
-				send_queue.pop_front();
-				n_queue = send_queue.size();
-			} else {
-				n_queue = 0;
+			// move retries whose backoff has expired to the send queue, here
+			// rather than in the timeout thread, which only wakes up rarely
+			if(!delay_queue.empty()) {
+				const int64_t now = clock_monotonic_us();
+				while(!delay_queue.empty() && delay_queue.begin()->first <= now) {
+					send_queue.push(delay_queue.begin()->second);
+					delay_queue.erase(delay_queue.begin());
+				}
+			}
+			any = true;
+			if(!hedge_queue.empty()) {
+				e = hedge_queue.front().first;
+				hedge_key.swap(hedge_queue.front().second);
+				hedge_queue.pop_front();
+				// original was answered in the meantime
+				if(pending.find(hedge_key) == pending.end())
+					continue;
+			} else if(!send_queue.pop(&e)) {
+				any = false;
 			}
+			n_queue = send_queue.size();
 		}
 
 		if(should_exit)
 			break;
+		// retries and the like go first
+		if(!any && callback_source && !source_empty) {
+			TRACE_SPAN("source callback");
+			any = callback_source(&e.id);
+			if(!any) {
+				MutexAutoLock alock(mtx);
+				source_empty = true;
+			}
+		}
 		if(!any) {
 			std::this_thread::sleep_for(std::chrono::milliseconds(25));
 			continue;
 		}
 
-		// find resolver with capacity
-retry_resolver:
-		size_t start = resolver_id;
-		any = false;
+		// maybe it can be answered without asking anyone
+		if(e.attempts == 0 && hedge_key.empty() &&
+			callback_local && callback_local(e.id)) {
+			metrics.local++;
+			continue;
+		}
+
+		// find resolver(s) with capacity
+		const unsigned wanted = hedge_key.empty() ? consensus : 1;
+		unsigned copies = wanted;
+		chosen.clear();
+		if(callback_route) {
+			route.clear();
+			callback_route(e.id, &route);
+			bool alive = false;
+			{
+				MutexAutoLock alock = lock_timed(mtx, metrics.lock_wait_us);
+				size_t wait_rid = SIZE_MAX;
+				// retrying elsewhere is only a preference, the second pass
+				// allows the resolver to avoid if it is the only one left
+				for(int pass = 0; pass < 2 && chosen.empty() && wait_rid == SIZE_MAX; pass++) {
+					for(size_t i = 0; i < route.size(); i++) {
+						// spread queries over the resolvers, retries go elsewhere
+						size_t rid = route[(i + e.id + e.attempts) % route.size()];
+						if(resolvers[rid].isDead())
+							continue;
+						alive = true;
+						if(pass == 0 && rid == e.avoid_resolver && route.size() > 1)
+							continue;
+						if(resolvers[rid].acquireCapacity()) {
+							chosen.push_back(rid);
+							break;
+						}
+						if(wait_rid == SIZE_MAX)
+							wait_rid = rid;
+					}
+				}
+				if(chosen.empty() && alive && hedge_key.empty()) {
+					// wait until a query of that resolver is done instead of
+					// trying again and again, other queries may go elsewhere
+					parked[wait_rid].push_back(e);
+				}
+			}
+			if(chosen.empty()) {
+				// (a hedge is only worth it if it can be sent right away)
+				if(!alive && hedge_key.empty()) {
+					metrics.failed++;
+					callback_fail(e.id);
+				}
+				continue;
+			}
+		}
 		{
-			MutexAutoLock alock(mtx);
-			do {
-				if(resolvers[resolver_id].acquireCapacity()) {
-					any = true;
+			TRACE_SPAN("question callback");
+			pkt.questions.clear();
+			pkt.questions.emplace_back(callback_question(e.id));
+		}
+
+		if(affinity_policy.labels > 0 && chosen.empty()) {
+			MutexAutoLock alock = lock_timed(mtx, metrics.lock_wait_us);
+			TRACE_SPAN("affinity");
+			preferredResolvers(pkt.questions[0].name, &route);
+			for(size_t rid : route) {
+				if(chosen.size() >= copies)
 					break;
+				if(rid != e.avoid_resolver && resolvers[rid].acquireCapacity())
+					chosen.push_back(rid);
+			}
+			// the rest is spread over everyone else as usual
+			if(chosen.size() < copies)
+				metrics.spilled++;
+		}
+		size_t avoid = e.avoid_resolver;
+		bool all_dead = false;
+		while(chosen.size() < copies) {
+			size_t start = resolver_id;
+			any = false;
+			{
+				MutexAutoLock alock = lock_timed(mtx, metrics.lock_wait_us);
+				do {
+					if(resolver_id != avoid &&
+						std::find(chosen.begin(), chosen.end(), resolver_id) == chosen.end() &&
+						resolvers[resolver_id].acquireCapacity()) {
+						any = true;
+						break;
+					}
+					resolver_id = (resolver_id + 1) % resolvers.size();
+				} while(resolver_id != start);
+
+				if(!any && avoid != SIZE_MAX && hedge_key.empty()) {
+					// retrying elsewhere is only a preference, it may be the only one left
+					avoid = SIZE_MAX;
+					continue;
 				}
-				resolver_id = (resolver_id + 1) % resolvers.size();
-			} while(resolver_id != start);
+				if(!any) {
+					// don't wait for resolvers that will never have capacity again
+					// (a hedge must not go to the resolver it duplicates)
+					unsigned alive = 0;
+					for(size_t rid = 0; rid < resolvers.size(); rid++)
+						alive += rid != avoid && !resolvers[rid].isDead() ? 1 : 0;
+					all_dead = alive == 0 && chosen.empty();
+					copies = std::min(copies, std::max(alive, 1U));
+				}
+			}
+			if(all_dead || chosen.size() >= copies)
+				break;
+			if(!any) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				continue;
+			}
+			chosen.push_back(resolver_id);
 		}
-		if(!any) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-			goto retry_resolver;
+		if(all_dead) {
+			// the original of a hedge is still pending
+			if(hedge_key.empty()) {
+				metrics.failed++;
+				callback_fail(e.id);
+			}
+			continue;
+		}
+		if(copies < wanted) {
+			// not enough resolvers left for all copies. a vote among fewer is
+			// counted, a single answer is no consensus at all and fails
+			metrics.degraded++;
+			if(copies < 2) {
+				{
+					MutexAutoLock alock = lock_timed(mtx, metrics.lock_wait_us);
+					for(size_t rid : chosen) {
+						resolvers[rid].restoreCapacity();
+						unpark(rid);
+					}
+				}
+				metrics.failed++;
+				callback_fail(e.id);
+				continue;
+			}
 		}
-		Resolver &res = resolvers[resolver_id];
 
-		// grab the next txid
-		// assumption: timeout * capacity << 0xffff so that txids never overlap
-		uint16_t txid = res.nextTxid();
+		ConsensusGroup *group = nullptr;
+		if(chosen.size() > 1)
+			group = new ConsensusGroup(e, chosen.size());
 
-		// build and send the packet
-		pkt.txid = txid;
-		pkt.questions.clear();
-		pkt.questions.emplace_back(callback_question(id));
-		pkt.encode(&data);
-		sock.sendto(data, res.addr);
+		for(size_t rid : chosen) {
+			Resolver &res = resolvers[rid];
 
-		const ustring key = res.addr.getIPBytes() + encode_u16(pkt.txid);
-		{
-			MutexAutoLock alock(mtx);
-			pending.emplace(key, new PendingQuery(id, resolver_id));
-		}
+			// grab the next txid
+			// assumption: timeout * capacity << 0xffff so that txids never overlap
+			pkt.txid = res.nextTxid();
 
-		n_sent++;
+			// build and send the packet
+			{
+				TRACE_SPAN("encode");
+				pkt.encode(&data);
+			}
+
+			// register before sending, the answer may arrive immediately
+			const ustring key = res.addr.getIPBytes() + encode_u16(res.addr.getPort()) + encode_u16(pkt.txid);
+			{
+				MutexAutoLock alock = lock_timed(mtx, metrics.lock_wait_us);
+				TRACE_SPAN("register");
+				PendingQuery *p = new PendingQuery(e, rid, key);
+				if(!hedge_key.empty()) {
+					auto it = pending.find(hedge_key);
+					if(it == pending.end()) {
+						// original was answered since the check above
+						res.restoreCapacity();
+						unpark(rid);
+						delete p;
+						continue;
+					}
+					p->hedged = true;
+					p->sibling = it->second;
+					it->second->sibling = p;
+				}
+				p->group = group;
+				pending.emplace(key, p);
+				res.n_sent++;
+			}
+
+			// before sending, so the answer can't end up in the capture first
+			if(recorder) {
+				TRACE_SPAN("record");
+				recorder->write(data, res.addr, local_port, true);
+			}
+			{
+				TRACE_SPAN("sendto");
+				sock->sendto(data, res.addr);
+			}
+
+			n_sent++;
+			metrics.sent++;
+		}
 	} while(1);
 }
 
 void QueryBackend::timeout_thread()
 {
+	TRACE_THREAD("timeout");
 	while(1) {
 again:
-		time_t cutoff = clock_monotonic() - timeout;
+		int64_t now = clock_monotonic_us();
+		int64_t cutoff = now - timeout * 1000000;
 
 		mtx.lock();
+		// forget cancelled queries once their answer would have timed out
+		for(auto it = cancelled.begin(); it != cancelled.end(); ) {
+			if(it->second <= cutoff)
+				it = cancelled.erase(it);
+			else
+				it++;
+		}
+
 		for(auto it = pending.begin(); it != pending.end(); it++) {
 			if(it->second->time_sent <= cutoff) {
+				TRACE_SPAN("timeout");
 				PendingQuery *p = it->second;
 				pending.erase(it);
+				metrics.timeouts++;
+				resolvers[p->resolver_id].n_timeout++;
 				if(timeout_keep_cap)
 					resolvers[p->resolver_id].restoreCapacity();
+				else
+					resolvers[p->resolver_id].dropCapacity();
+				unpark(p->resolver_id);
+				bool drop = false;
+				ConsensusGroup *group = nullptr;
+				if(p->sibling) {
+					// the other copy is still waiting
+					p->sibling->sibling = nullptr;
+					drop = true;
+				} else if(p->group) {
+					if(--p->group->outstanding == 0)
+						group = p->group;
+					drop = true;
+				}
 				mtx.unlock();
 
-				callback_timeout(p->id);
+				if(group)
+					vote(group);
+				else if(!drop)
+					retry(p->retryEntry());
 				delete p;
 
 				goto again; // iterate again immediately
@@ -236,18 +627,251 @@ again:
 
 		if(should_exit)
 			break;
-		std::this_thread::sleep_for(std::chrono::milliseconds(timeout * 1000 / 2));
+		if(hedge_policy.enabled) {
+			hedge(now);
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout * 1000 / 2));
+		}
 	}
 }
 
-static inline time_t clock_monotonic()
+void QueryBackend::hedge(int64_t now)
+{
+	// need some samples before the percentile means anything
+	if(metrics.rtt.count() < 100)
+		return;
+	int64_t cutoff = now - metrics.rtt.percentile(hedge_policy.percentile);
+
+	MutexAutoLock alock(mtx);
+	TRACE_SPAN("hedge");
+	if(hedge_policy.when_drained && (!send_queue.empty() || (callback_source && !source_empty)))
+		return;
+	if(resolvers.size() < 2)
+		return;
+	for(auto &it : pending) {
+		PendingQuery *p = it.second;
+		if(p->hedged || p->group || p->time_sent > cutoff)
+			continue;
+		if(metrics.hedged.get() >= hedge_policy.budget * n_sent)
+			break;
+		p->hedged = true;
+		hedge_queue.emplace_back(QueueEntry(p->id, p->attempts - 1, p->resolver_id, p->job), p->key);
+		metrics.hedged++;
+	}
+}
+
+// fingerprint of an answer that ignores TTLs and record order
+static std::string answer_fingerprint(const DNSPacket &pkt)
+{
+	std::vector<std::string> records;
+	for(auto a : pkt.answers) {
+		a.ttl = 0;
+		records.emplace_back(a.toString());
+	}
+	std::sort(records.begin(), records.end());
+
+	std::string ret(1, '0' + pkt.rcode());
+	for(auto &r : records)
+		ret += "\n" + r;
+	return ret;
+}
+
+void QueryBackend::vote(ConsensusGroup *group)
+{
+	// a majority needs more than half of all copies, those that timed out
+	// count against it. without enough answers for one it's asked again
+	if(group->answers.size() * 2 <= group->copies) {
+		retry(QueueEntry(group->id, group->attempts, SIZE_MAX, group->job));
+		delete group;
+		return;
+	}
+
+	std::vector<std::string> fprints;
+	std::unordered_map<std::string, unsigned> votes;
+	for(auto &it : group->answers) {
+		fprints.emplace_back(answer_fingerprint(it.second));
+		votes[fprints.back()]++;
+	}
+	auto best = votes.begin();
+	for(auto it = votes.begin(); it != votes.end(); it++) {
+		if(it->second > best->second)
+			best = it;
+	}
+
+	const unsigned total = group->answers.size();
+	if(best->second < total) {
+		// penalise resolvers that disagree with the majority
+		MutexAutoLock alock(mtx);
+		for(size_t i = 0; i < total; i++) {
+			if(fprints[i] != best->first)
+				resolvers[group->answers[i].first].penalize();
+		}
+	}
+	if(best->second < total && callback_conflict)
+		callback_conflict(group->id, best->second, total);
+
+	if(best->second * 2 > group->copies) {
+		for(size_t i = 0; i < total; i++) {
+			if(fprints[i] == best->first) {
+				callback_answer(group->answers[i].second, group->id);
+				break;
+			}
+		}
+	} else {
+		metrics.failed++;
+		callback_fail(group->id);
+	}
+	delete group;
+}
+
+void QueryBackend::retry(const QueueEntry &e)
+{
+	if(e.attempts > retry_policy.max_retries) {
+		metrics.failed++;
+		callback_fail(e.id);
+		return;
+	}
+	metrics.retries++;
+
+	MutexAutoLock alock(mtx);
+	QueueEntry e2(e);
+	if(resolvers.size() < 2)
+		e2.avoid_resolver = SIZE_MAX;
+	if(retry_policy.backoff > 0) {
+		int64_t when = clock_monotonic_us() + retry_policy.backoff * e.attempts * 1000000;
+		delay_queue.emplace(when, e2);
+	} else {
+		send_queue.push(e2);
+	}
+}
+
+// called with the mutex held whenever a query sent to the resolver is done
+void QueryBackend::unpark(size_t rid)
+{
+	auto it = parked.find(rid);
+	if(it == parked.end())
+		return;
+	// as many as it can take now, or all of them to go elsewhere (or fail)
+	// once it is dead
+	const Resolver &res = resolvers[rid];
+	size_t n = res.isDead() ? it->second.size() : std::min<size_t>(res.capacity, it->second.size());
+	for(; n > 0; n--) {
+		send_queue.push(it->second.front());
+		it->second.pop_front();
+	}
+	if(it->second.empty())
+		parked.erase(it);
+}
+
+// consistent hashing: a zone belongs to the resolvers following its hash on
+// the ring, so adding or losing a resolver only moves the zones it had
+void QueryBackend::preferredResolvers(const DNSName &name, std::vector<size_t> *out)
+{
+	if(ring.size() != resolvers.size() * AFFINITY_POINTS) {
+		ring.clear();
+		for(size_t rid = 0; rid < resolvers.size(); rid++) {
+			// by address, so that zones keep their resolvers across runs
+			const Resolver &res = resolvers[rid];
+			const uint64_t h = std::hash<ustring>()(res.addr.getIPBytes() + encode_u16(res.addr.getPort()));
+			for(unsigned i = 0; i < AFFINITY_POINTS; i++)
+				ring.emplace_back(mix64(h + i), rid);
+		}
+		std::sort(ring.begin(), ring.end());
+	}
+
+	std::string zone;
+	const auto &labels = name.labels;
+	size_t first = labels.size() - std::min<size_t>(labels.size(), affinity_policy.labels);
+	for(size_t i = first; i < labels.size(); i++) {
+		for(char c : labels[i])
+			zone += tolower(c);
+		zone += '.';
+	}
+	const uint64_t h = mix64(std::hash<std::string>()(zone));
+
+	out->clear();
+	auto it = std::lower_bound(ring.begin(), ring.end(), std::make_pair(h, (size_t) 0));
+	for(size_t n = 0; n < ring.size() && out->size() < affinity_policy.resolvers; n++, it++) {
+		if(it == ring.end())
+			it = ring.begin();
+		const size_t rid = it->second;
+		if(resolvers[rid].isDead() || std::find(out->begin(), out->end(), rid) != out->end())
+			continue;
+		out->push_back(rid);
+	}
+}
+
+// stride of a job with weight 1, larger weights advance in smaller steps
+#define STRIDE_BASE 0x100000
+
+void FairQueue::setWeight(unsigned job, unsigned weight)
+{
+	getJob(job).weight = std::max(weight, 1U);
+}
+
+void FairQueue::push(const QueueEntry &e)
+{
+	Job &j = getJob(e.job);
+	// a job that was idle doesn't get to catch up on the sends it missed
+	if(j.queue.empty())
+		j.pass = std::max(j.pass, pass);
+	j.queue.push_back(e);
+	n++;
+}
+
+bool FairQueue::pop(QueueEntry *e)
+{
+	Job *next = nullptr;
+	for(auto &j : jobs) {
+		if(!j.queue.empty() && (!next || j.pass < next->pass))
+			next = &j;
+	}
+	if(!next)
+		return false;
+	*e = next->queue.front();
+	next->queue.pop_front();
+	pass = next->pass;
+	next->pass += STRIDE_BASE / next->weight;
+	n--;
+	return true;
+}
+
+FairQueue::Job &FairQueue::getJob(unsigned job)
+{
+	if(job >= jobs.size())
+		jobs.resize(job + 1);
+	return jobs[job];
+}
+
+static inline int64_t clock_monotonic_us()
 {
 	struct timespec t;
 	clock_gettime(CLOCK_MONOTONIC, &t);
-	return t.tv_sec;
+	return t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+}
+
+static inline MutexAutoLock lock_timed(std::mutex &m, Counter &wait_us)
+{
+	MutexAutoLock l(m, std::try_to_lock);
+	if(!l.owns_lock()) {
+		TRACE_SPAN("lock wait");
+		int64_t start = clock_monotonic_us();
+		l.lock();
+		wait_us += clock_monotonic_us() - start;
+	}
+	return l;
 }
 
 static inline ustring encode_u16(uint16_t v)
 {
 	return ustring(reinterpret_cast<unsigned char*>(&v), 2);
 }
+
+static inline uint64_t mix64(uint64_t v)
+{
+	// splitmix64 finalizer
+	v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+	return v ^ (v >> 31);
+}
@@ -0,0 +1,143 @@
+// End-to-end benchmark: drives QueryBackend against mockdns and reports
+// throughput, CPU time per query and memory usage.
+#include <getopt.h>
+#include <time.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "backend.hpp"
+#include "socket.hpp"
+#include "dns.hpp"
+
+static void usage();
+static inline double clock_seconds();
+static inline double cpu_seconds();
+
+int main(int argc, char *argv[])
+{
+	std::string addr = "127.0.0.1";
+	int first_port = 5300, nports = 1;
+	unsigned n_queries = 200000, concurrent = 50;
+	time_t timeout = 2;
+
+	int c;
+	while((c = getopt(argc, argv, "a:c:hn:p:P:t:")) != -1) {
+		switch(c) {
+			case 'a':
+				addr = optarg;
+				break;
+			case 'c':
+				concurrent = atoi(optarg);
+				break;
+			case 'n':
+				n_queries = atoi(optarg);
+				break;
+			case 'p':
+				first_port = atoi(optarg);
+				break;
+			case 'P':
+				nports = atoi(optarg);
+				break;
+			case 't':
+				timeout = atoi(optarg);
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	std::vector<SocketAddress> resolvers;
+	for(int i = 0; i < nports; i++) {
+		SocketAddress sa;
+		if(!sa.parseIP(addr)) {
+			std::cerr << "Invalid address." << std::endl;
+			return 1;
+		}
+		sa.setPort(first_port + i);
+		resolvers.push_back(sa);
+	}
+
+	// the question is built on demand, like query_main does from its list
+	DNSQuestion q;
+	q.qtype = DNS_TYPE_A;
+	q.qclass = DNS_CLASS_IN;
+	q.name.parse("0.bench.example.");
+
+	std::atomic<uint32_t> n_done(0), n_failed(0);
+	// keep capacity on timeouts so that simulated loss doesn't throttle the run
+	QueryBackend backend(resolvers, concurrent, timeout, true);
+	auto cb_query = [&] (QueryID id) -> DNSQuestion {
+		DNSQuestion ret = q;
+		ret.name.labels[0] = std::to_string(id);
+		return ret;
+	};
+	auto cb_answer = [&] (const DNSPacket &pkt, QueryID id) {
+		n_done++;
+	};
+	auto cb_fail = [&] (QueryID id) {
+		n_failed++;
+		n_done++;
+	};
+	backend.setCallbacks(cb_query, cb_answer, cb_fail);
+	RetryPolicy policy;
+	policy.max_retries = 3;
+	backend.setRetryPolicy(policy);
+
+	for(unsigned i = 0; i < n_queries; i++)
+		backend.queue(i);
+
+	const double t0 = clock_seconds(), cpu0 = cpu_seconds();
+	backend.start();
+	while(n_done < n_queries)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	const double t1 = clock_seconds(), cpu1 = cpu_seconds();
+	backend.stopJoin();
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	const Metrics &m = backend.getMetrics();
+	std::cout
+		<< "queries:        " << n_queries << " (" << n_failed << " failed, "
+			<< m.retries.get() << " retries)" << std::endl
+		<< "wall time:      " << (t1 - t0) << " s" << std::endl
+		<< "throughput:     " << (unsigned) (n_queries / (t1 - t0)) << " queries/s" << std::endl
+		<< "cpu per query:  " << ((cpu1 - cpu0) * 1e6 / n_queries) << " us" << std::endl
+		<< "rtt p50/p99:    " << m.rtt.percentile(50) << " / " << m.rtt.percentile(99) << " us" << std::endl
+		<< "lock wait:      " << (m.lock_wait_us.get() / 1000) << " ms" << std::endl
+		<< "max rss:        " << (ru.ru_maxrss / 1024) << " MiB" << std::endl;
+	return 0;
+}
+
+static void usage()
+{
+	std::cout
+		<< "Usage: bench_e2e [options]" << std::endl
+		<< "Options:" << std::endl
+		<< "  -a <addr>   Address of mockdns (defaults to 127.0.0.1)" << std::endl
+		<< "  -p <port>   First port of mockdns (defaults to 5300)" << std::endl
+		<< "  -P <count>  Number of ports, each is used as a resolver (defaults to 1)" << std::endl
+		<< "  -n <count>  Number of queries (defaults to 200000)" << std::endl
+		<< "  -c <n>      Concurrent queries per resolver (defaults to 50)" << std::endl
+		<< "  -t <sec>    Query timeout (defaults to 2)" << std::endl
+	;
+}
+
+static inline double clock_seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static inline double cpu_seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,94 @@
+// Microbenchmarks for the CPU-heavy parts of the query and answer path.
+#include <time.h>
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <functional>
+
+#include "common.hpp"
+#include "dns.hpp"
+#include "query.hpp"
+#include "input.hpp"
+
+static void bench(const char *name, unsigned iterations, std::function<void()> fn);
+static inline double clock_seconds();
+
+// PTR answer for 2.0.0.0.[...].ip6.arpa. pointing to panda.he.net.
+static ustring make_answer()
+{
+	DNSQuestion q;
+	q.parse("2.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.1.7.0.0.0.0.0.0.0.7.4.0.1.0.0.2.ip6.arpa. PTR");
+	DNSPacket pkt;
+	pkt.txid = 0x1234;
+	pkt.flags = 0x0100;
+	pkt.questions.push_back(q);
+	ustring data;
+	pkt.encode(&data);
+
+	data[2] |= 0x80; // QR
+	data[7] = 1; // ancount
+	const unsigned char rr[] = {
+		0xc0, 0x0c, 0, 12, 0, 1, 0, 1, 0x4c, 0xc9, 0, 14,
+		5, 'p', 'a', 'n', 'd', 'a', 2, 'h', 'e', 3, 'n', 'e', 't', 0,
+	};
+	data.append(rr, sizeof(rr));
+	return data;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned n = argc > 1 ? atoi(argv[1]) : 200000;
+
+	DNSPacket query;
+	query.txid = 1;
+	query.flags = 0x0100;
+	query.questions.resize(1);
+	query.questions[0].parse("2.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.1.7.0.0.0.0.0.0.0.7.4.0.1.0.0.2.ip6.arpa. PTR");
+	ustring data;
+	bench("DNSPacket::encode", n, [&] () {
+		query.encode(&data);
+	});
+
+	const ustring answer = make_answer();
+	DNSPacket pkt;
+	bench("DNSPacket::decode", n, [&] () {
+		pkt.decode(answer);
+	});
+
+	std::string str;
+	bench("DNSAnswer::toString", n, [&] () {
+		str = pkt.answers[0].toString();
+	});
+
+	std::string list;
+	for(unsigned i = 0; i < n; i++) {
+		list += std::to_string(i % 10) + ".0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.1.7.0.0.0.0.0.0.0.7.4.0.1."
+			+ std::to_string(i / 10 % 10) + "." + std::to_string(i / 100) + ".ip6.arpa.\tPTR\n";
+	}
+	QueryList queries;
+	double t0 = clock_seconds();
+	{
+		std::istringstream iss(list);
+		parse_query_list(iss, queries);
+	}
+	// reported per line, since the list is only parsed once
+	std::cout << "parse_query_list: " << ((clock_seconds() - t0) / n * 1e9) << " ns" << std::endl;
+
+	return 0;
+}
+
+static void bench(const char *name, unsigned iterations, std::function<void()> fn)
+{
+	double t0 = clock_seconds();
+	for(unsigned i = 0; i < iterations; i++)
+		fn();
+	double t = clock_seconds() - t0;
+	std::cout << name << ": " << (t / iterations * 1e9) << " ns" << std::endl;
+}
+
+static inline double clock_seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
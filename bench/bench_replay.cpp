@@ -0,0 +1,123 @@
+// Replays a capture made with --record through the receive path (decoding,
+// matching against the pending queries, formatting the records) without sockets.
+#include <time.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+
+#include "common.hpp"
+#include "dns.hpp"
+#include "pcap.hpp"
+
+static inline double clock_seconds();
+
+static inline ustring encode_u16(uint16_t v)
+{
+	return ustring(1, v >> 8) + ustring(1, v & 0xff);
+}
+
+// same key as the query backend's pending table
+static inline ustring pending_key(const SocketAddress &addr, uint16_t txid)
+{
+	return addr.getIPBytes() + encode_u16(addr.getPort()) + encode_u16(txid);
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc < 2) {
+		std::cerr << "Usage: bench_replay <capture file> [iterations]" << std::endl;
+		return 1;
+	}
+	unsigned iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+	// everything is loaded first so that reading the file isn't measured
+	std::vector<CapturedPacket> packets;
+	{
+		PcapReader reader;
+		if(!reader.open(argv[1])) {
+			std::cerr << "Failed to open capture (must be from --record)." << std::endl;
+			return 1;
+		}
+		CapturedPacket pkt;
+		while(reader.next(&pkt))
+			packets.push_back(pkt);
+	}
+
+	std::ofstream out("/dev/null");
+	size_t n_answers = 0, n_unmatched = 0, n_invalid = 0, n_records = 0;
+	double t_decode = 0, t_total = 0;
+	for(unsigned it = 0; it < iterations; it++) {
+		std::unordered_map<ustring, size_t> pending;
+		DNSPacket pkt;
+		n_answers = n_unmatched = n_invalid = n_records = 0;
+
+		double t0 = clock_seconds();
+		for(size_t i = 0; i < packets.size(); i++) {
+			const CapturedPacket &c = packets[i];
+			const uint16_t txid = (c.payload[0] << 8) | c.payload[1];
+			if(c.outgoing) {
+				pending[pending_key(c.remote, txid)] = i;
+				continue;
+			}
+
+			try {
+				pkt.decode(c.payload);
+			} catch(const DecodeException &e) {
+				n_invalid++;
+				continue;
+			} catch(const std::ios_base::failure &e) {
+				n_invalid++;
+				continue;
+			}
+
+			auto p = pending.find(pending_key(c.remote, txid));
+			if(p == pending.end()) {
+				n_unmatched++;
+				continue;
+			}
+			pending.erase(p);
+			n_answers++;
+
+			if(pkt.rcode() != DNS_RCODE_NOERROR)
+				continue;
+			for(auto &a : pkt.answers)
+				out << a.toString() << "\n";
+			n_records += pkt.answers.size();
+		}
+		t_total += clock_seconds() - t0;
+
+		// once more, only decoding
+		t0 = clock_seconds();
+		for(auto &c : packets) {
+			if(c.outgoing)
+				continue;
+			try {
+				pkt.decode(c.payload);
+			} catch(const DecodeException &e) {
+			} catch(const std::ios_base::failure &e) {
+			}
+		}
+		t_decode += clock_seconds() - t0;
+	}
+
+	std::cout << packets.size() << " packets, " << n_answers << " answers with "
+		<< n_records << " records";
+	if(n_unmatched > 0 || n_invalid > 0)
+		std::cout << " (" << n_unmatched << " unmatched, " << n_invalid << " invalid)";
+	std::cout << std::endl;
+	if(n_answers == 0)
+		return 0;
+	const double per = 1e9 / ((double) n_answers * iterations);
+	std::cout << "total: " << (t_total * per) << " ns per answer" << std::endl;
+	std::cout << "DNSPacket::decode: " << (t_decode * per) << " ns per answer" << std::endl;
+	return 0;
+}
+
+static inline double clock_seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,358 @@
+// Mock DNS resolver for benchmarking, answers on one or more UDP ports
+// with synthesized records and configurable latency, loss, errors and rate limits.
+#include <getopt.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <random>
+
+struct Reply {
+	int64_t when;
+	int sock;
+	struct sockaddr_in6 dst;
+	std::string data;
+
+	bool operator>(const Reply &o) const { return when > o.when; }
+};
+
+struct Port {
+	int fd;
+	int64_t window_start;
+	unsigned window_count;
+};
+
+static unsigned latency_ms = 0, jitter_ms = 0;
+static double loss = 0, truncation = 0;
+static double rcode_pct[16] = { 0 };
+static unsigned rate_limit = 0;
+
+static std::mt19937 rng(1);
+
+static void usage();
+static bool parse_rcode_mix(const char *s);
+static int open_socket(const std::string &addr, int port);
+static bool make_reply(const unsigned char *q, size_t len, std::string *out);
+static inline int64_t clock_ms();
+static inline double random01();
+
+int main(int argc, char *argv[])
+{
+	std::string addr = "127.0.0.1";
+	int first_port = 5300, nports = 1;
+	bool quiet = false;
+
+	int c;
+	while((c = getopt(argc, argv, "a:e:hj:l:L:n:p:qR:t:")) != -1) {
+		switch(c) {
+			case 'a':
+				addr = optarg;
+				break;
+			case 'e':
+				if(!parse_rcode_mix(optarg)) {
+					std::cerr << "Invalid rcode mix." << std::endl;
+					return 1;
+				}
+				break;
+			case 'j':
+				jitter_ms = atoi(optarg);
+				break;
+			case 'l':
+				latency_ms = atoi(optarg);
+				break;
+			case 'L':
+				loss = atof(optarg) / 100;
+				break;
+			case 'n':
+				nports = atoi(optarg);
+				break;
+			case 'p':
+				first_port = atoi(optarg);
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'R':
+				rate_limit = atoi(optarg);
+				break;
+			case 't':
+				truncation = atof(optarg) / 100;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if(nports < 1 || first_port < 1 || first_port + nports > 0x10000) {
+		usage();
+		return 1;
+	}
+
+	std::vector<Port> ports;
+	std::vector<struct pollfd> pfds;
+	for(int i = 0; i < nports; i++) {
+		int fd = open_socket(addr, first_port + i);
+		if(fd == -1) {
+			std::cerr << "Failed to bind " << addr << " port " << (first_port + i)
+				<< ": " << strerror(errno) << std::endl;
+			return 1;
+		}
+		ports.push_back(Port{fd, 0, 0});
+		pfds.push_back(pollfd{fd, POLLIN, 0});
+	}
+	if(!quiet)
+		std::cerr << "Listening on " << addr << " ports " << first_port << "-"
+			<< (first_port + nports - 1) << std::endl;
+
+	std::priority_queue<Reply, std::vector<Reply>, std::greater<Reply>> delayed;
+	unsigned char buf[4096];
+	uint64_t n_queries = 0, n_dropped = 0;
+	int64_t last_report = clock_ms();
+
+	while(1) {
+		int64_t now = clock_ms();
+		while(!delayed.empty() && delayed.top().when <= now) {
+			const Reply &r = delayed.top();
+			sendto(r.sock, r.data.c_str(), r.data.size(), 0,
+				(struct sockaddr*) &r.dst, sizeof(r.dst));
+			delayed.pop();
+		}
+		if(!quiet && now - last_report >= 1000) {
+			std::cerr << n_queries << " queries, " << n_dropped << " dropped\r";
+			last_report = now;
+		}
+
+		int timeout = delayed.empty() ? 1000 : (int) (delayed.top().when - now);
+		if(poll(pfds.data(), pfds.size(), timeout) <= 0)
+			continue;
+
+		now = clock_ms();
+		for(size_t i = 0; i < pfds.size(); i++) {
+			if(!(pfds[i].revents & POLLIN))
+				continue;
+			Port &port = ports[i];
+			// drain the socket, it is non-blocking
+			while(1) {
+				struct sockaddr_in6 src;
+				socklen_t srclen = sizeof(src);
+				ssize_t r = recvfrom(port.fd, buf, sizeof(buf), 0,
+					(struct sockaddr*) &src, &srclen);
+				if(r <= 0)
+					break;
+				n_queries++;
+
+				if(rate_limit > 0) {
+					if(now - port.window_start >= 1000) {
+						port.window_start = now;
+						port.window_count = 0;
+					}
+					if(++port.window_count > rate_limit) {
+						n_dropped++;
+						continue;
+					}
+				}
+				if(random01() < loss) {
+					n_dropped++;
+					continue;
+				}
+
+				Reply rep;
+				if(!make_reply(buf, r, &rep.data))
+					continue;
+				rep.sock = port.fd;
+				rep.dst = src;
+				rep.when = now + latency_ms;
+				if(jitter_ms > 0)
+					rep.when += rng() % (jitter_ms + 1);
+
+				if(rep.when <= now) {
+					sendto(rep.sock, rep.data.c_str(), rep.data.size(), 0,
+						(struct sockaddr*) &rep.dst, sizeof(rep.dst));
+				} else {
+					delayed.push(rep);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void usage()
+{
+	std::cout
+		<< "Usage: mockdns [options]" << std::endl
+		<< "Options:" << std::endl
+		<< "  -a <addr>         Address to listen on (defaults to 127.0.0.1)" << std::endl
+		<< "  -p <port>         First port to listen on (defaults to 5300)" << std::endl
+		<< "  -n <count>        Number of consecutive ports (defaults to 1)" << std::endl
+		<< "  -l <ms>           Answer latency" << std::endl
+		<< "  -j <ms>           Additional random latency" << std::endl
+		<< "  -L <pct>          Percentage of queries to drop" << std::endl
+		<< "  -e <rcode>=<pct>  Answer with an error this often, e.g. SERVFAIL=5,NXDOMAIN=20" << std::endl
+		<< "  -t <pct>          Percentage of answers to truncate (TC bit, no records)" << std::endl
+		<< "  -R <qps>          Drop queries above this rate (per port)" << std::endl
+		<< "  -q                No status output" << std::endl
+	;
+}
+
+static bool parse_rcode_mix(const char *s)
+{
+	static const char *names[] = {
+		"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+	};
+	std::istringstream iss(s);
+	std::string item;
+	while(std::getline(iss, item, ',')) {
+		size_t eq = item.find('=');
+		if(eq == std::string::npos)
+			return false;
+		const std::string name = item.substr(0, eq);
+		int rcode = -1;
+		for(int i = 0; i < 6; i++) {
+			if(name == names[i])
+				rcode = i;
+		}
+		if(rcode == -1)
+			return false;
+		rcode_pct[rcode] = atof(item.c_str() + eq + 1) / 100;
+	}
+	return true;
+}
+
+static int open_socket(const std::string &addr, int port)
+{
+	struct sockaddr_in6 sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin6_family = AF_INET6;
+	sa.sin6_port = htons(port);
+	if(inet_pton(AF_INET6, addr.c_str(), &sa.sin6_addr) != 1) {
+		// ipv4-mapped
+		struct in_addr tmp;
+		if(inet_pton(AF_INET, addr.c_str(), &tmp) != 1)
+			return -1;
+		sa.sin6_addr.s6_addr[10] = sa.sin6_addr.s6_addr[11] = 0xff;
+		memcpy(&sa.sin6_addr.s6_addr[12], &tmp, 4);
+	}
+
+	int fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if(fd == -1)
+		return -1;
+	int zero = 0, bufsize = 4 << 20;
+	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+	if(bind(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static inline void put16(std::string &s, uint16_t v)
+{
+	s += (char) (v >> 8);
+	s += (char) (v & 0xff);
+}
+
+static inline void put32(std::string &s, uint32_t v)
+{
+	put16(s, v >> 16);
+	put16(s, v & 0xffff);
+}
+
+static bool make_reply(const unsigned char *q, size_t len, std::string *out)
+{
+	if(len < 12 || (q[2] & 0x80)) // too short or not a query
+		return false;
+
+	// find the end of the (first) question
+	size_t i = 12;
+	uint32_t hash = 2166136261u;
+	while(i < len && q[i] != 0) {
+		if(q[i] >= 64)
+			return false; // no compression in questions
+		for(size_t j = i + 1; j <= i + q[i] && j < len; j++)
+			hash = (hash ^ (q[j] | 0x20)) * 16777619u;
+		i += q[i] + 1;
+	}
+	if(i + 5 > len)
+		return false;
+	const size_t qend = i + 5;
+	const uint16_t qtype = (q[i + 1] << 8) | q[i + 2];
+
+	// pick the rcode
+	int rcode = 0;
+	double r = random01(), acc = 0;
+	for(int k = 1; k < 16; k++) {
+		acc += rcode_pct[k];
+		if(r < acc) {
+			rcode = k;
+			break;
+		}
+	}
+	bool truncated = rcode == 0 && random01() < truncation;
+
+	std::string rdata;
+	if(rcode == 0 && !truncated) {
+		if(qtype == 1) { // A
+			put32(rdata, 0x0a000000 | (hash & 0xffffff));
+		} else if(qtype == 28) { // AAAA
+			put32(rdata, 0x20010db8);
+			put32(rdata, 0);
+			put32(rdata, 0);
+			put32(rdata, hash);
+		} else if(qtype == 12 || qtype == 2 || qtype == 5) { // PTR, NS, CNAME
+			char lbl[16];
+			snprintf(lbl, sizeof(lbl), "h%08x", hash);
+			rdata += (char) strlen(lbl);
+			rdata += lbl;
+			rdata += "\x04mock";
+			rdata += (char) 0;
+		}
+	}
+
+	out->assign((const char*) q, 2); // txid
+	uint16_t flags = 0x8000 | (q[2] & 0x01) << 8 | 0x80 | rcode; // QR, RD copied, RA
+	if(truncated)
+		flags |= 0x0200;
+	put16(*out, flags);
+	put16(*out, 1); // qdcount
+	put16(*out, rdata.empty() ? 0 : 1); // ancount
+	put16(*out, 0);
+	put16(*out, 0);
+	out->append((const char*) q + 12, qend - 12);
+	if(!rdata.empty()) {
+		put16(*out, 0xc00c); // pointer to the question name
+		put16(*out, qtype);
+		put16(*out, 1); // IN
+		put32(*out, 300);
+		put16(*out, rdata.size());
+		*out += rdata;
+	}
+	return true;
+}
+
+static inline int64_t clock_ms()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+static inline double random01()
+{
+	return std::uniform_real_distribution<double>(0, 1)(rng);
+}
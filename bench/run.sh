@@ -0,0 +1,16 @@
+#!/bin/sh -e
+# Runs the benchmark suite against a local mockdns instance.
+# Extra arguments are passed to mockdns, e.g. ./run.sh -l 2 -L 1
+cd "$(dirname "$0")"
+PORTS=4
+
+./mockdns -q -n $PORTS "$@" &
+MOCK=$!
+trap 'kill $MOCK' EXIT
+sleep 0.5
+
+echo "== micro"
+./bench_micro
+echo
+echo "== end-to-end"
+./bench_e2e -P $PORTS -c 100 -t 1
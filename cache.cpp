@@ -0,0 +1,100 @@
+#include <ctype.h>
+
+#include "cache.hpp"
+#include "dns.hpp"
+
+#define CNAME_MAX_DEPTH 8
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+static std::string name_key(const DNSName &name)
+{
+	std::string ret = name.toString();
+	for(auto &c : ret)
+		c = tolower(c);
+	return ret;
+}
+
+std::string AnswerCache::key(const DNSName &name, enum DNSType type, enum DNSClass class_)
+{
+	std::string ret = name_key(name);
+	ret += ' ';
+	ret += std::to_string((int) type);
+	ret += ' ';
+	ret += std::to_string((int) class_);
+	return ret;
+}
+
+void AnswerCache::insert(const std::string &key, const Entry &e)
+{
+	MutexAutoLock alock(mtx);
+	entries[key] = e;
+}
+
+// collects the records answering <name> by following CNAMEs,
+// returns false if the chain doesn't end in a record of the wanted type
+static bool follow_chain(const DNSName &name, enum DNSType type, const DNSPacket &pkt,
+	std::vector<DNSAnswer> &out, int depth)
+{
+	if(depth == 0)
+		return false;
+	const std::string want = name_key(name);
+	bool complete = false;
+	for(auto &a : pkt.answers) {
+		if(name_key(a.name) != want)
+			continue;
+		out.push_back(a);
+		if(a.type == type)
+			complete = true;
+		else if(a.type == DNS_TYPE_CNAME)
+			complete |= follow_chain(a.rdata.name, type, pkt, out, depth - 1);
+	}
+	return complete;
+}
+
+void AnswerCache::insertTargets(const DNSQuestion &q, const DNSPacket &pkt)
+{
+	if(pkt.rcode() != DNS_RCODE_NOERROR || q.qtype == DNS_TYPE_CNAME)
+		return;
+	for(auto &a : pkt.answers) {
+		if(a.type != DNS_TYPE_CNAME)
+			continue;
+		Entry e;
+		e.rcode = DNS_RCODE_NOERROR;
+		if(follow_chain(a.rdata.name, q.qtype, pkt, e.records, CNAME_MAX_DEPTH))
+			insert(key(a.rdata.name, q.qtype, q.qclass), e);
+	}
+}
+
+void AnswerCache::insertNxdomain(const DNSName &name)
+{
+	if(name.labels.empty())
+		return;
+	MutexAutoLock alock(mtx);
+	nxdomain.insert(name_key(name));
+}
+
+bool AnswerCache::lookup(const DNSQuestion &q, Entry *e)
+{
+	MutexAutoLock alock(mtx);
+	if(!nxdomain.empty()) {
+		// check the name and all of its parents
+		const std::string name = name_key(q.name);
+		size_t pos = 0;
+		for(size_t i = 0; i < q.name.labels.size(); i++) {
+			if(nxdomain.count(name.substr(pos)) > 0) {
+				e->rcode = DNS_RCODE_NXDOMAIN;
+				e->records.clear();
+				n_nxdomain_hits++;
+				return true;
+			}
+			pos += q.name.labels[i].size() + 1;
+		}
+	}
+	auto it = entries.find(key(q));
+	if(it == entries.end())
+		return false;
+	*e = it->second;
+	n_hits++;
+	return true;
+}
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <vector>
+#include <string>
+#include <mutex>
+
+#include "dnshammer.h"
+#include "client.hpp"
+#include "socket.hpp"
+#include "dns.hpp"
+
+// retries of a query before it fails, the default of the command line
+#define DEFAULT_MAX_RETRIES 10
+
+struct dnshammer {
+	DNSClient client;
+	RetryPolicy retry;
+	std::once_flag started; // by the first dnshammer_submit()
+
+	dnshammer(const std::vector<SocketAddress> &resolvers, unsigned concurrent, unsigned timeout) :
+		client(resolvers, concurrent, timeout) {
+		retry.max_retries = DEFAULT_MAX_RETRIES;
+	}
+};
+
+static void deliver(const DNSResult &result, dnshammer_callback callback, void *userdata);
+
+dnshammer *dnshammer_new(const char *const *resolvers, size_t count,
+	unsigned concurrent, unsigned timeout)
+{
+	std::vector<SocketAddress> addrs;
+	for(size_t i = 0; i < count; i++) {
+		SocketAddress addr;
+		if(!addr.parse(resolvers[i], 53))
+			return nullptr;
+		addrs.push_back(addr);
+	}
+	if(addrs.empty() || concurrent < 1 || timeout < 1)
+		return nullptr;
+
+	return new dnshammer(addrs, concurrent, timeout);
+}
+
+void dnshammer_set_retries(dnshammer *h, unsigned max_retries, unsigned backoff,
+	int retry_errors)
+{
+	h->retry.max_retries = max_retries;
+	h->retry.backoff = backoff;
+	h->retry.retry_errors = retry_errors != 0;
+}
+
+int dnshammer_submit(dnshammer *h, const char *name, uint16_t type,
+	dnshammer_callback callback, void *userdata)
+{
+	DNSQuestion q;
+	try {
+		q.name.parse(name);
+	} catch(const DecodeException &e) {
+		return -1;
+	}
+	q.qtype = (enum DNSType) type;
+	q.qclass = DNS_CLASS_IN;
+
+	std::call_once(h->started, [h] () {
+		h->client.setRetryPolicy(h->retry);
+		h->client.start();
+	});
+	h->client.submit(q, [callback, userdata] (const DNSResult &result) {
+		deliver(result, callback, userdata);
+	});
+	return 0;
+}
+
+size_t dnshammer_outstanding(dnshammer *h)
+{
+	return h->client.outstanding();
+}
+
+void dnshammer_free(dnshammer *h)
+{
+	delete h;
+}
+
+static void deliver(const DNSResult &result, dnshammer_callback callback, void *userdata)
+{
+	if(!result.ok) {
+		callback(-1, nullptr, 0, userdata);
+		return;
+	}
+
+	const auto &answers = result.packet.answers;
+	// keep the strings alive until the callback returns
+	std::vector<std::string> strings(answers.size() * 2);
+	std::vector<struct dnshammer_record> records(answers.size());
+	for(size_t i = 0; i < answers.size(); i++) {
+		const DNSAnswer &a = answers[i];
+		struct dnshammer_record &r = records[i];
+		memset(&r, 0, sizeof(r));
+		strings[i*2] = a.name.toString();
+		r.name = strings[i*2].c_str();
+		r.type = a.type;
+		r.class_ = a.class_;
+		r.ttl = a.ttl;
+		switch(a.type) {
+			case DNS_TYPE_A:
+				memcpy(r.addr, &a.rdata.addr4, 4);
+				break;
+			case DNS_TYPE_AAAA:
+				memcpy(r.addr, &a.rdata.addr6, 16);
+				break;
+			case DNS_TYPE_NS:
+			case DNS_TYPE_CNAME:
+			case DNS_TYPE_PTR:
+				strings[i*2+1] = a.rdata.name.toString();
+				r.target = strings[i*2+1].c_str();
+				break;
+			default:
+				break;
+		}
+	}
+	callback(result.packet.rcode(), records.data(), records.size(), userdata);
+}
@@ -0,0 +1,143 @@
+#include <sstream>
+
+#include "chain.hpp"
+#include "cache.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+static DNSQuestion make_question(const DNSName &name, enum DNSType type, enum DNSClass class_)
+{
+	DNSQuestion q;
+	q.name = name;
+	q.qtype = type;
+	q.qclass = class_;
+	return q;
+}
+
+ChainFollower::ChainFollower(unsigned rules, QueryID first_id) :
+	rules(rules), first_id(first_id)
+{
+}
+
+bool ChainFollower::parseRules(const std::string &s, unsigned *rules)
+{
+	std::istringstream iss(s);
+	std::string rule;
+	*rules = 0;
+	while(std::getline(iss, rule, ',')) {
+		if(rule == "cname")
+			*rules |= FOLLOW_CNAME;
+		else if(rule == "ns")
+			*rules |= FOLLOW_NS;
+		else if(rule == "mx")
+			*rules |= FOLLOW_MX;
+		else if(rule == "ptr")
+			*rules |= FOLLOW_PTR;
+		else if(rule == "aaaa")
+			*rules |= FOLLOW_AAAA;
+		else
+			return false;
+	}
+	return *rules != 0;
+}
+
+DNSQuestion ChainFollower::question(QueryID id)
+{
+	MutexAutoLock alock(mtx);
+	return questions.at(id - first_id).q;
+}
+
+QueryID ChainFollower::origin(QueryID id)
+{
+	if(!isFollowUp(id))
+		return id;
+	MutexAutoLock alock(mtx);
+	return questions.at(id - first_id).origin;
+}
+
+bool ChainFollower::answer(QueryID id, const DNSQuestion &q, const std::vector<DNSAnswer> &records,
+	std::vector<QueryID> *follow_ups, std::vector<DNSAnswer> *chain)
+{
+	std::vector<DNSQuestion> next;
+	MutexAutoLock alock(mtx);
+	QueryID origin = id;
+	unsigned depth = 0;
+	if(isFollowUp(id)) {
+		const FollowUp &f = questions.at(id - first_id);
+		origin = f.origin;
+		depth = f.depth;
+	}
+	if(depth < CHAIN_MAX_DEPTH)
+		collect(q, records, &next);
+
+	auto it = chains.find(origin);
+	if(it == chains.end()) {
+		if(next.empty()) {
+			// nothing to follow, the common case
+			*chain = records;
+			return true;
+		}
+		it = chains.emplace(origin, Chain()).first;
+		if(origin == id)
+			it->second.asked.insert(AnswerCache::key(q));
+	}
+	Chain &c = it->second;
+	c.records.insert(c.records.end(), records.begin(), records.end());
+	for(auto &nq : next) {
+		// the same name can come up more than once (e.g. NS targets)
+		if(!c.asked.insert(AnswerCache::key(nq)).second)
+			continue;
+		follow_ups->push_back(first_id + questions.size());
+		questions.push_back(FollowUp{nq, origin, depth + 1});
+		c.pending++;
+	}
+	if(origin != id)
+		c.pending--;
+	if(c.pending > 0)
+		return false;
+	chain->swap(c.records);
+	chains.erase(it);
+	return true;
+}
+
+void ChainFollower::collect(const DNSQuestion &q, const std::vector<DNSAnswer> &records,
+	std::vector<DNSQuestion> *res)
+{
+	// where the answer ends up after its CNAMEs
+	DNSName target = q.name;
+	for(unsigned n = 0; n < records.size(); n++) {
+		bool found = false;
+		for(auto &a : records) {
+			if(a.type == DNS_TYPE_CNAME && a.name.equals(target)) {
+				target = a.rdata.name;
+				found = true;
+				break;
+			}
+		}
+		if(!found)
+			break;
+	}
+
+	bool has_target = false, has_a = false;
+	for(auto &a : records) {
+		if(!a.name.equals(target))
+			continue;
+		has_target |= a.type == q.qtype;
+		has_a |= a.type == DNS_TYPE_A;
+	}
+	if((rules & FOLLOW_CNAME) && !has_target && q.qtype != DNS_TYPE_CNAME && !target.equals(q.name))
+		res->push_back(make_question(target, q.qtype, q.qclass));
+	if((rules & FOLLOW_AAAA) && has_a && q.qtype == DNS_TYPE_A)
+		res->push_back(make_question(target, DNS_TYPE_AAAA, q.qclass));
+
+	for(auto &a : records) {
+		bool follow = (a.type == DNS_TYPE_NS && (rules & FOLLOW_NS)) ||
+			(a.type == DNS_TYPE_MX && (rules & FOLLOW_MX)) ||
+			(a.type == DNS_TYPE_PTR && (rules & FOLLOW_PTR));
+		if(!follow || a.rdata.name.labels.empty())
+			continue;
+		res->push_back(make_question(a.rdata.name, DNS_TYPE_A, q.qclass));
+		if(rules & FOLLOW_AAAA)
+			res->push_back(make_question(a.rdata.name, DNS_TYPE_AAAA, q.qclass));
+	}
+}
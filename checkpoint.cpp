@@ -0,0 +1,113 @@
+#include <stdio.h> // rename()
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h> // fsync()
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include "checkpoint.hpp"
+
+/*
+	File format (all integers little endian):
+	u32 magic
+	u64 number of queries
+	u64 output file offset
+	u64 failed file offset
+	u64[] completion bitmap
+*/
+static const uint32_t MAGIC = 0x4b434844; // "DHCK"
+
+static void writeU64(std::ostream &s, uint64_t v)
+{
+	v = htole64(v);
+	s.write((char*) &v, 8);
+}
+
+static uint64_t readU64(std::istream &s)
+{
+	uint64_t v = 0;
+	s.read((char*) &v, 8);
+	return le64toh(v);
+}
+
+Checkpoint::Checkpoint(size_t n) :
+	n(n), words((n + 63) / 64), bits(new std::atomic<uint64_t>[words])
+{
+	for(size_t i = 0; i < words; i++)
+		bits[i] = 0;
+}
+
+size_t Checkpoint::countDone() const
+{
+	size_t ret = 0;
+	for(size_t i = 0; i < words; i++)
+		ret += __builtin_popcountll(bits[i].load(std::memory_order_relaxed));
+	return ret;
+}
+
+void Checkpoint::snapshot(std::vector<uint64_t> *done) const
+{
+	done->resize(words);
+	for(size_t i = 0; i < words; i++)
+		(*done)[i] = htole64(bits[i].load(std::memory_order_relaxed));
+}
+
+bool Checkpoint::save(const std::string &path, uint64_t out_offset, uint64_t fail_offset,
+	const std::vector<uint64_t> &done) const
+{
+	// write to a temporary file first, a crash mid-write must not
+	// destroy the previous checkpoint
+	const std::string tmp = path + ".tmp";
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		uint32_t magic = htole32(MAGIC);
+		f.write((char*) &magic, 4);
+		writeU64(f, n);
+		writeU64(f, out_offset);
+		writeU64(f, fail_offset);
+		f.write((char*) done.data(), words * 8);
+		f.flush();
+		if(!f.good())
+			return false;
+	}
+	// the data has to reach the disk before the rename does, otherwise a
+	// power loss can leave an empty file in place of the old one
+	if(!sync_file(tmp))
+		return false;
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool Checkpoint::load(const std::string &path, uint64_t *out_offset, uint64_t *fail_offset)
+{
+	std::ifstream f(path, std::ios::binary);
+	uint32_t magic = 0;
+	f.read((char*) &magic, 4);
+	if(!f.good() || le32toh(magic) != MAGIC) {
+		std::cerr << "Not a valid checkpoint file." << std::endl;
+		return false;
+	}
+	if(readU64(f) != n) {
+		std::cerr << "Checkpoint was made with a different list of queries." << std::endl;
+		return false;
+	}
+	*out_offset = readU64(f);
+	*fail_offset = readU64(f);
+	for(size_t i = 0; i < words; i++)
+		bits[i] = readU64(f);
+	if(!f.good()) {
+		std::cerr << "Checkpoint file is truncated." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool sync_file(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd == -1)
+		return false;
+	int r = fsync(fd);
+	close(fd);
+	return r == 0;
+}
@@ -0,0 +1,153 @@
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+
+#include "client.hpp"
+#include "backend.hpp"
+#include "dns.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+struct DNSClient::Impl {
+	struct Request {
+		DNSQuestion question;
+		Callback callback;
+	};
+
+	QueryBackend backend;
+	bool running = false;
+
+	std::mutex mtx;
+	std::unordered_map<QueryID, Request> requests;
+	QueryID next_id = 0;
+
+	Impl(const std::vector<SocketAddress> &resolvers, unsigned concurrent, time_t timeout) :
+		backend(resolvers, concurrent, timeout) {}
+	void complete(QueryID id, const DNSResult &result);
+};
+
+DNSClient::DNSClient(const std::vector<SocketAddress> &resolvers,
+	unsigned concurrent, time_t timeout) :
+	impl(new Impl(resolvers, concurrent, timeout))
+{
+	Impl *d = impl.get();
+	auto cb_query = [d] (QueryID id) -> DNSQuestion {
+		MutexAutoLock alock(d->mtx);
+		auto it = d->requests.find(id);
+		// completed already (a hedge racing its answer), the backend drops
+		// the send because the original is no longer pending
+		if(it == d->requests.end())
+			return DNSQuestion();
+		return it->second.question;
+	};
+	auto cb_answer = [d] (const DNSPacket &pkt, QueryID id) {
+		DNSResult result;
+		result.ok = true;
+		result.packet = pkt;
+		d->complete(id, result);
+	};
+	auto cb_fail = [d] (QueryID id) {
+		DNSResult result;
+		result.ok = false;
+		d->complete(id, result);
+	};
+	d->backend.setCallbacks(cb_query, cb_answer, cb_fail);
+}
+
+DNSClient::~DNSClient()
+{
+	stop();
+}
+
+void DNSClient::setRetryPolicy(const RetryPolicy &policy)
+{
+	impl->backend.setRetryPolicy(policy);
+}
+
+void DNSClient::setHedgePolicy(const HedgePolicy &policy)
+{
+	impl->backend.setHedgePolicy(policy);
+}
+
+void DNSClient::setAffinityPolicy(const AffinityPolicy &policy)
+{
+	impl->backend.setAffinityPolicy(policy);
+}
+
+void DNSClient::start()
+{
+	if(impl->running)
+		return;
+	impl->backend.start();
+	impl->running = true;
+}
+
+void DNSClient::submit(const DNSQuestion &q, Callback callback)
+{
+	QueryID id;
+	{
+		MutexAutoLock alock(impl->mtx);
+		id = impl->next_id++;
+		impl->requests.emplace(id, Impl::Request{q, callback});
+	}
+	impl->backend.queue(id);
+}
+
+std::future<DNSResult> DNSClient::submit(const DNSQuestion &q)
+{
+	// std::function needs a copyable callable
+	auto promise = std::make_shared<std::promise<DNSResult>>();
+	submit(q, [promise] (const DNSResult &result) {
+		promise->set_value(result);
+	});
+	return promise->get_future();
+}
+
+size_t DNSClient::outstanding()
+{
+	MutexAutoLock alock(impl->mtx);
+	return impl->requests.size();
+}
+
+const Metrics &DNSClient::getMetrics() const
+{
+	return impl->backend.getMetrics();
+}
+
+void DNSClient::getResolverStats(std::vector<ResolverStats> *stats)
+{
+	impl->backend.getResolverStats(stats);
+}
+
+void DNSClient::stop()
+{
+	if(impl->running) {
+		impl->backend.stopJoin();
+		impl->running = false;
+	}
+
+	// whatever is left will never complete
+	std::unordered_map<QueryID, Impl::Request> left;
+	{
+		MutexAutoLock alock(impl->mtx);
+		left.swap(impl->requests);
+	}
+	DNSResult result;
+	result.ok = false;
+	for(auto &it : left)
+		it.second.callback(result);
+}
+
+void DNSClient::Impl::complete(QueryID id, const DNSResult &result)
+{
+	Callback callback;
+	{
+		MutexAutoLock alock(mtx);
+		auto it = requests.find(id);
+		if(it == requests.end())
+			return;
+		callback.swap(it->second.callback);
+		requests.erase(it);
+	}
+	callback(result);
+}
@@ -0,0 +1,131 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "compress.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+GzipStreamBuf::GzipStreamBuf(int level) : level(level), buf(GZIP_BLOCK_SIZE)
+{
+	setp(buf.data(), buf.data() + buf.size());
+}
+
+GzipStreamBuf::~GzipStreamBuf()
+{
+	if(thread) {
+		sync();
+		{
+			MutexAutoLock alock(mtx);
+			should_exit = true;
+		}
+		cv.notify_one();
+		thread->join();
+		delete thread;
+	}
+	if(fd != -1)
+		close(fd);
+}
+
+bool GzipStreamBuf::open(const std::string &path, bool append)
+{
+	int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+	fd = ::open(path.c_str(), flags, 0644);
+	if(fd == -1)
+		return false;
+	off_t size = lseek(fd, 0, SEEK_END);
+	written = size > 0 ? size : 0;
+
+	thread = new std::thread(&GzipStreamBuf::compress_thread, this);
+	return true;
+}
+
+GzipStreamBuf::int_type GzipStreamBuf::overflow(int_type c)
+{
+	submit();
+	if(!traits_type::eq_int_type(c, traits_type::eof()))
+		sputc(c);
+	return failed ? traits_type::eof() : traits_type::not_eof(c);
+}
+
+int GzipStreamBuf::sync()
+{
+	submit();
+	MutexAutoLock alock(mtx);
+	cv_idle.wait(alock, [this] () { return queue.empty() && !busy; });
+	return failed ? -1 : 0;
+}
+
+GzipStreamBuf::pos_type GzipStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir,
+	std::ios_base::openmode which)
+{
+	// only telling the position is supported
+	if(off != 0 || dir != std::ios_base::cur || sync() != 0)
+		return pos_type(off_type(-1));
+	MutexAutoLock alock(mtx);
+	return pos_type(written);
+}
+
+// hands the buffered data to the compression thread
+void GzipStreamBuf::submit()
+{
+	if(pptr() == pbase())
+		return;
+	{
+		MutexAutoLock alock(mtx);
+		queue.emplace_back(pbase(), pptr() - pbase());
+	}
+	cv.notify_one();
+	setp(buf.data(), buf.data() + buf.size());
+}
+
+void GzipStreamBuf::compress_thread()
+{
+	std::string in, out;
+	while(1) {
+		{
+			MutexAutoLock alock(mtx);
+			busy = false;
+			if(queue.empty())
+				cv_idle.notify_all();
+			cv.wait(alock, [this] () { return !queue.empty() || should_exit; });
+			if(queue.empty())
+				break;
+			in.swap(queue.front());
+			queue.pop_front();
+			busy = true;
+		}
+
+		// every block becomes a complete gzip member
+		z_stream z = { 0 };
+		bool ok = deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+		if(ok) {
+			out.resize(deflateBound(&z, in.size()));
+			z.next_in = (Bytef*) &in[0];
+			z.avail_in = in.size();
+			z.next_out = (Bytef*) &out[0];
+			z.avail_out = out.size();
+			ok = deflate(&z, Z_FINISH) == Z_STREAM_END;
+			out.resize(out.size() - z.avail_out);
+			deflateEnd(&z);
+		}
+
+		size_t off = 0;
+		while(ok && off < out.size()) {
+			ssize_t r = write(fd, out.c_str() + off, out.size() - off);
+			if(r <= 0)
+				ok = false;
+			else
+				off += r;
+		}
+
+		MutexAutoLock alock(mtx);
+		written += off;
+		failed |= !ok;
+	}
+}
+
+bool is_gzip_path(const std::string &path)
+{
+	return path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+}
@@ -0,0 +1,281 @@
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "daemon.hpp"
+#include "query.hpp"
+#include "client.hpp"
+#include "backend.hpp"
+#include "metrics.hpp"
+#include "socket.hpp"
+#include "dns.hpp"
+#include "trace.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+static volatile sig_atomic_t got_signal = 0;
+
+static void handle_signal(int sig)
+{
+	got_signal = 1;
+}
+
+static int unix_socket(const std::string &path, bool listening)
+{
+	struct sockaddr_un addr = { 0 };
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path))
+		return -1;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd == -1)
+		return -1;
+	int r;
+	if(listening) {
+		// a stale socket of an earlier run, but never anything else
+		struct stat st;
+		if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(path.c_str());
+		r = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+		if(r == 0)
+			r = listen(fd, 64);
+	} else {
+		r = connect(fd, (struct sockaddr*) &addr, sizeof(addr));
+	}
+	if(r != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**** Daemon ****/
+
+// results of a batch, filled by the client's callbacks and written
+// to the connection by its own thread (callbacks may not block)
+struct Batch {
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::string result;
+	size_t left = 0, answered = 0, failed = 0;
+};
+
+static std::atomic<unsigned> n_conns(0), n_batches(0);
+
+static bool serve_batch(DNSClient &client, LineConn &conn, bool *eof)
+{
+	auto batch = std::make_shared<Batch>();
+	std::vector<std::pair<size_t, DNSQuestion>> questions;
+	std::string line, errors;
+	size_t index = 0;
+	while(1) {
+		if(!conn.readLine(&line)) {
+			*eof = true;
+			break;
+		}
+		if(!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if(line.empty())
+			break;
+
+		DNSQuestion q;
+		try {
+			q.parse(line);
+			questions.emplace_back(index, q);
+		} catch(DecodeException &e) {
+			errors += std::to_string(index) + "\tE\n";
+		}
+		index++;
+	}
+	if(index == 0 && *eof)
+		return false;
+
+	batch->left = questions.size();
+	for(auto &it : questions) {
+		const std::string prefix = std::to_string(it.first) + "\t";
+		client.submit(it.second, [batch, prefix] (const DNSResult &r) {
+			MutexAutoLock alock(batch->mtx);
+			if(!r.ok) {
+				batch->result += prefix + "F\n";
+				batch->failed++;
+			} else {
+				if(r.packet.rcode() == DNS_RCODE_NOERROR) {
+					for(auto &a : r.packet.answers)
+						batch->result += prefix + "A\t" + a.toString() + "\n";
+				}
+				batch->answered++;
+			}
+			batch->left--;
+			batch->cv.notify_one();
+		});
+	}
+	if(!errors.empty() && !conn.write(errors))
+		return false;
+
+	// stream the results as they come in
+	MutexAutoLock alock(batch->mtx);
+	while(1) {
+		batch->cv.wait(alock, [&batch] () {
+			return !batch->result.empty() || batch->left == 0;
+		});
+		std::string out;
+		out.swap(batch->result);
+		bool last = batch->left == 0;
+		alock.unlock();
+		if(!out.empty() && !conn.write(out))
+			return false;
+		if(last)
+			break;
+		alock.lock();
+	}
+
+	n_batches++;
+	std::ostringstream oss;
+	oss << "DONE " << batch->answered << " " << batch->failed << "\n";
+	return conn.write(oss.str());
+}
+
+static void serve(DNSClient *client, int fd)
+{
+	LineConn conn(fd);
+	bool eof = false;
+	while(!eof && serve_batch(*client, conn, &eof))
+		;
+	n_conns--;
+}
+
+int daemon_main(const QueryOptions &opts, const std::string &path,
+	std::vector<SocketAddress> &resolvers)
+{
+	DNSClient client(resolvers, opts.concurrent, TIMEOUT_SEC);
+	client.setRetryPolicy(retry_policy(opts));
+	if(opts.hedge_percentile > 0)
+		client.setHedgePolicy(hedge_policy(opts));
+	client.setAffinityPolicy(affinity_policy(opts));
+
+	int listen_fd = unix_socket(path, true);
+	if(listen_fd == -1) {
+		std::cerr << "Failed to listen on " << path << "." << std::endl;
+		return 1;
+	}
+	MetricsExporter exporter;
+	if(!opts.metrics_target.empty() && !exporter.open(opts.metrics_target)) {
+		std::cerr << "Failed to open metrics target." << std::endl;
+		return 1;
+	}
+	std::vector<ResolverStats> resolver_stats;
+
+	client.start();
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	std::cerr << "Waiting for queries on " << path << " with "
+		<< resolvers.size() << " resolvers." << std::endl;
+	std::cerr << std::endl;
+
+	const Metrics &m = client.getMetrics();
+	time_t last_update = 0;
+	while(!got_signal) {
+		struct pollfd pfd = { listen_fd, POLLIN, 0 };
+		if(poll(&pfd, 1, 1000) > 0) {
+			int fd = accept(listen_fd, NULL, NULL);
+			if(fd != -1) {
+				n_conns++;
+				std::thread(serve, &client, fd).detach();
+			}
+		}
+
+		if(time(nullptr) == last_update)
+			continue;
+		last_update = time(nullptr);
+		if(!opts.quiet) {
+			std::cerr << n_batches << " batches done, " << n_conns << " clients connected, sent "
+				<< m.sent.get() << " queries, got " << m.received.get() << " answers\r";
+			std::cerr.flush();
+		}
+		if(!opts.metrics_target.empty()) {
+			client.getResolverStats(&resolver_stats);
+			exporter.update(m, resolver_stats);
+		}
+	}
+	::close(listen_fd);
+	unlink(path.c_str());
+
+	client.getResolverStats(&resolver_stats);
+	std::cerr << "\n\n" << metrics_summary(m, resolver_stats);
+	std::cerr << "\nDone!" << std::endl;
+	trace_dump_before_exit();
+	// connection threads may still be blocked on their client
+	_Exit(0);
+}
+
+/**** Client ****/
+
+int submit_main(std::ostream &outfile, const QueryOptions &opts,
+	const std::string &path, QueryList &queries)
+{
+	int fd = unix_socket(path, false);
+	if(fd == -1) {
+		std::cerr << "Failed to connect to " << path << "." << std::endl;
+		return 1;
+	}
+	LineConn conn(fd);
+
+	std::string batch;
+	for(size_t i = 0; i < queries.size(); i++)
+		batch += queries[i].toString() + "\n";
+	batch += "\n";
+	if(!conn.write(batch)) {
+		std::cerr << "Lost connection to the daemon." << std::endl;
+		return 1;
+	}
+
+	std::string line;
+	while(1) {
+		if(!conn.readLine(&line)) {
+			std::cerr << "Lost connection to the daemon." << std::endl;
+			return 1;
+		}
+		std::istringstream iss(line);
+		if(line.compare(0, 5, "DONE ") == 0) {
+			std::string cmd;
+			size_t answered = 0, failed = 0;
+			iss >> cmd >> answered >> failed;
+			if(!opts.quiet)
+				std::cerr << answered << " queries were answered, " << failed << " failed." << std::endl;
+			break;
+		}
+
+		size_t index = SIZE_MAX;
+		char tab;
+		std::string kind;
+		iss >> index;
+		iss.get(tab);
+		std::getline(iss, kind, '\t');
+		if(index >= queries.size()) {
+			std::cerr << "Invalid result from the daemon." << std::endl;
+			return 1;
+		}
+		if(kind == "A") {
+			std::string record;
+			std::getline(iss, record);
+			for(unsigned n = queries.copies(index); n > 0; n--)
+				outfile << record << "\n";
+		} else if(opts.failfile) {
+			for(unsigned n = queries.copies(index); n > 0; n--)
+				*opts.failfile << queries[index].toString() << "\n";
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,467 @@
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <iostream>
+#include <sstream>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "distributed.hpp"
+#include "query.hpp"
+#include "backend.hpp"
+#include "socket.hpp"
+#include "dns.hpp"
+#include "filter.hpp"
+#include "trace.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+static int tcp_socket(const SocketAddress &addr, bool listening)
+{
+	int fd = socket(AF_INET6, SOCK_STREAM, 0);
+	if(fd == -1)
+		return -1;
+	int zero = 0, one = 1;
+	setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+	int r;
+	if(listening) {
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		r = bind(fd, (struct sockaddr*) &addr.addr, sizeof(addr.addr));
+		if(r == 0)
+			r = listen(fd, 64);
+	} else {
+		r = connect(fd, (struct sockaddr*) &addr.addr, sizeof(addr.addr));
+	}
+	if(r != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static inline time_t clock_monotonic()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec;
+}
+
+/**** Coordinator ****/
+
+struct Lease {
+	size_t first, count;
+	enum { PENDING, LEASED, DONE } state = PENDING;
+	time_t deadline = 0;
+	unsigned owner = 0; // connection it was handed to
+};
+
+struct WorkerStats {
+	std::string addr;
+	uint64_t leases = 0, sent = 0, received = 0, timeouts = 0, retries = 0;
+};
+
+struct Coordinator {
+	std::ostream &outfile;
+	const QueryOptions &opts;
+	QueryList &queries;
+
+	std::mutex mtx;
+	std::vector<Lease> leases;
+	std::deque<size_t> pending;
+	std::vector<WorkerStats> workers;
+	size_t n_done = 0; // leases
+	uint32_t n_succ = 0;
+	std::atomic<unsigned> n_conns;
+
+	Coordinator(std::ostream &outfile, const QueryOptions &opts, QueryList &queries) :
+		outfile(outfile), opts(opts), queries(queries), n_conns(0) {}
+
+	void serve(int fd, unsigned conn_id);
+	bool handOut(LineConn &conn, unsigned conn_id);
+	bool collect(LineConn &conn, std::istringstream &header, unsigned conn_id);
+};
+
+bool Coordinator::handOut(LineConn &conn, unsigned conn_id)
+{
+	std::ostringstream oss;
+	{
+		MutexAutoLock alock(mtx);
+		// give leases that weren't completed in time to someone else
+		time_t now = clock_monotonic();
+		for(size_t i = 0; i < leases.size(); i++) {
+			if(leases[i].state == Lease::LEASED && leases[i].deadline <= now) {
+				leases[i].state = Lease::PENDING;
+				pending.push_back(i);
+			}
+		}
+
+		while(!pending.empty() && leases[pending.front()].state != Lease::PENDING)
+			pending.pop_front();
+		if(pending.empty()) {
+			oss << (n_done == leases.size() ? "DONE" : "WAIT") << "\n";
+		} else {
+			size_t i = pending.front();
+			pending.pop_front();
+			Lease &l = leases[i];
+			l.state = Lease::LEASED;
+			l.deadline = now + opts.lease_time;
+			l.owner = conn_id;
+			oss << "LEASE " << i << " " << l.count << "\n";
+			for(size_t j = l.first; j < l.first + l.count; j++)
+				oss << queries[j].toString() << "\n";
+		}
+	}
+	return conn.write(oss.str());
+}
+
+bool Coordinator::collect(LineConn &conn, std::istringstream &header, unsigned conn_id)
+{
+	size_t lease_id, lines;
+	WorkerStats delta;
+	header >> lease_id >> lines >> delta.sent >> delta.received >> delta.timeouts >> delta.retries;
+	if(!header || lease_id >= leases.size())
+		return false;
+
+	// the count comes from the worker, allocate as the lines arrive
+	std::vector<std::string> data;
+	std::string line;
+	for(size_t i = 0; i < lines; i++) {
+		if(!conn.readLine(&line))
+			return false;
+		data.push_back(std::move(line));
+	}
+
+	MutexAutoLock alock(mtx);
+	WorkerStats &w = workers[conn_id];
+	w.leases++;
+	w.sent += delta.sent;
+	w.received += delta.received;
+	w.timeouts += delta.timeouts;
+	w.retries += delta.retries;
+
+	// the lease may have been completed by someone else after it expired
+	Lease &l = leases[lease_id];
+	if(l.state != Lease::DONE) {
+		std::vector<bool> succ(l.count, false);
+		for(auto &line : data) {
+			std::istringstream iss(line);
+			size_t idx;
+			std::string kind;
+			iss >> idx >> kind;
+			if(!iss || idx >= l.count)
+				continue;
+			size_t id = l.first + idx;
+			if(kind == "A") {
+				std::string record;
+				iss.ignore(1);
+				std::getline(iss, record);
+				for(unsigned n = queries.copies(id); n > 0; n--)
+					outfile << record << "\n";
+				succ[idx] = true;
+			} else if(kind == "F" && opts.failfile) {
+				for(unsigned n = queries.copies(id); n > 0; n--)
+					*opts.failfile << queries[id].toString() << "\n";
+			}
+		}
+		for(bool b : succ)
+			n_succ += b ? 1 : 0;
+		l.state = Lease::DONE;
+		n_done++;
+	}
+	return conn.write("OK\n");
+}
+
+void Coordinator::serve(int fd, unsigned conn_id)
+{
+	LineConn conn(fd);
+	std::string line;
+	while(conn.readLine(&line)) {
+		std::istringstream iss(line);
+		std::string cmd;
+		iss >> cmd;
+		bool ok;
+		if(cmd == "LEASE") {
+			ok = handOut(conn, conn_id);
+		} else if(cmd == "RESULT") {
+			ok = collect(conn, iss, conn_id);
+		} else {
+			ok = false;
+		}
+		if(!ok)
+			break;
+	}
+
+	// whatever this worker still had will not be completed
+	MutexAutoLock alock(mtx);
+	for(size_t i = 0; i < leases.size(); i++) {
+		if(leases[i].state == Lease::LEASED && leases[i].owner == conn_id) {
+			leases[i].state = Lease::PENDING;
+			pending.push_back(i);
+		}
+	}
+	n_conns--;
+}
+
+int coordinator_main(std::ostream &outfile, const QueryOptions &opts,
+	const SocketAddress &listen_addr, QueryList &queries)
+{
+	Coordinator c(outfile, opts, queries);
+	for(size_t i = 0; i < queries.size(); i += opts.lease_size) {
+		Lease l;
+		l.first = i;
+		l.count = std::min((size_t) opts.lease_size, queries.size() - i);
+		c.leases.push_back(l);
+		c.pending.push_back(c.leases.size() - 1);
+	}
+
+	int listen_fd = tcp_socket(listen_addr, true);
+	if(listen_fd == -1) {
+		std::cerr << "Failed to listen on " << listen_addr.toString(true) << "." << std::endl;
+		return 1;
+	}
+	std::cerr << "Coordinating " << queries.size() << " queries in " << c.leases.size()
+		<< " leases on " << listen_addr.toString(true) << "." << std::endl;
+	std::cerr << std::endl;
+
+	time_t done_since = 0;
+	while(1) {
+		struct pollfd pfd = { listen_fd, POLLIN, 0 };
+		if(poll(&pfd, 1, 1000) > 0) {
+			struct sockaddr_in6 peer;
+			socklen_t peerlen = sizeof(peer);
+			int fd = accept(listen_fd, (struct sockaddr*) &peer, &peerlen);
+			if(fd != -1) {
+				unsigned conn_id;
+				{
+					MutexAutoLock alock(c.mtx);
+					SocketAddress addr;
+					addr.addr = peer;
+					c.workers.emplace_back();
+					c.workers.back().addr = addr.toString(true);
+					conn_id = c.workers.size() - 1;
+				}
+				c.n_conns++;
+				std::thread(&Coordinator::serve, &c, fd, conn_id).detach();
+			}
+		}
+
+		MutexAutoLock alock(c.mtx);
+		if(!opts.quiet) {
+			std::cerr << c.n_done << " of " << c.leases.size() << " leases done, "
+				<< c.n_conns << " workers connected, " << c.n_succ << " successful\r";
+			std::cerr.flush();
+		}
+		if(c.n_done == c.leases.size()) {
+			// let the workers pick up their DONE before going away
+			if(done_since == 0)
+				done_since = clock_monotonic();
+			if(c.n_conns == 0 || clock_monotonic() - done_since >= 5)
+				break;
+		}
+	}
+	::close(listen_fd);
+
+	MutexAutoLock alock(c.mtx);
+	WorkerStats total;
+	std::cerr << "\n\n";
+	for(auto &w : c.workers) {
+		if(w.leases == 0)
+			continue;
+		std::cerr << w.addr << ": " << w.leases << " leases, sent " << w.sent
+			<< ", answers " << w.received << ", timeouts " << w.timeouts
+			<< ", retries " << w.retries << "\n";
+		total.sent += w.sent;
+		total.received += w.received;
+		total.timeouts += w.timeouts;
+		total.retries += w.retries;
+	}
+	std::cerr << "Queries sent: " << total.sent << ", answers: " << total.received
+		<< ", timeouts: " << total.timeouts << ", retries: " << total.retries << "\n";
+	std::cerr << c.n_succ << " queries were successful.\nDone!" << std::endl;
+	outfile.flush();
+	if(opts.failfile)
+		opts.failfile->flush();
+	trace_dump_before_exit();
+	// worker threads may still be blocked on their connection
+	_Exit(0);
+}
+
+/**** Worker ****/
+
+struct WorkerLease {
+	size_t id; // coordinator's lease id
+	std::vector<DNSQuestion> questions;
+	std::string result;
+	size_t lines = 0, done = 0;
+};
+
+int worker_main(const QueryOptions &opts, const SocketAddress &coordinator,
+	std::vector<SocketAddress> &resolvers)
+{
+	int fd = tcp_socket(coordinator, false);
+	if(fd == -1) {
+		std::cerr << "Failed to connect to " << coordinator.toString(true) << "." << std::endl;
+		return 1;
+	}
+	LineConn conn(fd);
+
+	QueryBackend backend(resolvers, opts.concurrent, TIMEOUT_SEC);
+	configure_backend(backend, opts);
+
+	// query ids are assigned consecutively, each lease starts at its base id
+	std::mutex mtx;
+	std::map<QueryID, WorkerLease> leases;
+	QueryID next_base = 0;
+	auto cb_query = [&] (QueryID id) -> DNSQuestion {
+		MutexAutoLock alock(mtx);
+		auto it = leases.upper_bound(id);
+		it--;
+		return it->second.questions[id - it->first];
+	};
+	auto cb_answer = [&] (const DNSPacket &pkt, QueryID id) {
+		MutexAutoLock alock(mtx);
+		auto it = leases.upper_bound(id);
+		it--;
+		WorkerLease &l = it->second;
+		if(pkt.rcode() == DNS_RCODE_NOERROR) {
+			for(auto &a : pkt.answers) {
+				if(opts.filter && !opts.filter->matches(a, l.questions[id - it->first]))
+					continue;
+				l.result += std::to_string(id - it->first) + "\tA\t" + a.toString() + "\n";
+				l.lines++;
+			}
+		}
+		l.done++;
+	};
+	auto cb_fail = [&] (QueryID id) {
+		MutexAutoLock alock(mtx);
+		auto it = leases.upper_bound(id);
+		it--;
+		WorkerLease &l = it->second;
+		l.result += std::to_string(id - it->first) + "\tF\n";
+		l.lines++;
+		l.done++;
+	};
+	backend.setCallbacks(cb_query, cb_answer, cb_fail);
+	backend.start();
+
+	std::cerr << "Working for " << coordinator.toString(true) << " with "
+		<< resolvers.size() << " resolvers." << std::endl;
+
+	const Metrics &m = backend.getMetrics();
+	uint64_t prev_sent = 0, prev_recv = 0, prev_timeouts = 0, prev_retries = 0;
+	bool finished = false;
+	time_t wait_until = 0, last_progress = clock_monotonic();
+	uint32_t prev_n_sent = 0;
+	size_t n_leases = 0;
+	std::string line;
+	while(1) {
+		{
+			// same hang detection as query_main, the leases go to someone else
+			uint32_t n_sent, n_queue;
+			backend.getStats(&n_sent, &n_queue, nullptr);
+			if(n_sent != prev_n_sent || n_queue == 0) {
+				last_progress = clock_monotonic();
+			} else if(clock_monotonic() - last_progress >= TIMEOUT_SEC + 1) {
+				std::cerr << "Error: No resolvers are responding anymore, exiting." << std::endl;
+				trace_dump_before_exit();
+				_Exit(1);
+			}
+			prev_n_sent = n_sent;
+		}
+
+		// return completed leases
+		std::vector<std::string> results;
+		{
+			MutexAutoLock alock(mtx);
+			for(auto it = leases.begin(); it != leases.end(); ) {
+				WorkerLease &l = it->second;
+				if(l.done < l.questions.size()) {
+					it++;
+					continue;
+				}
+				std::ostringstream oss;
+				uint64_t sent = m.sent.get(), recv = m.received.get();
+				uint64_t timeouts = m.timeouts.get(), retries = m.retries.get();
+				oss << "RESULT " << l.id << " " << l.lines << " " << (sent - prev_sent)
+					<< " " << (recv - prev_recv) << " " << (timeouts - prev_timeouts)
+					<< " " << (retries - prev_retries) << "\n" << l.result;
+				prev_sent = sent;
+				prev_recv = recv;
+				prev_timeouts = timeouts;
+				prev_retries = retries;
+				results.push_back(oss.str());
+				it = leases.erase(it);
+			}
+		}
+		for(auto &r : results) {
+			if(!conn.write(r) || !conn.readLine(&line) || line != "OK")
+				goto lost;
+			n_leases++;
+		}
+
+		size_t active;
+		{
+			MutexAutoLock alock(mtx);
+			active = leases.size();
+		}
+		if(finished && active == 0)
+			break;
+
+		if(!finished && active < WORKER_LEASES && clock_monotonic() >= wait_until) {
+			if(!conn.write("LEASE\n") || !conn.readLine(&line))
+				goto lost;
+			std::istringstream iss(line);
+			std::string cmd;
+			iss >> cmd;
+			if(cmd == "DONE") {
+				finished = true;
+			} else if(cmd == "WAIT") {
+				wait_until = clock_monotonic() + 1;
+			} else if(cmd == "LEASE") {
+				WorkerLease l;
+				size_t count = 0;
+				iss >> l.id >> count;
+				l.questions.resize(count);
+				for(auto &q : l.questions) {
+					if(!conn.readLine(&line))
+						goto lost;
+					try {
+						q.parse(line);
+					} catch(const DecodeException &e) {
+						std::cerr << "Invalid question from coordinator: " << line << std::endl;
+						goto lost;
+					}
+				}
+
+				QueryID base = next_base;
+				next_base += count;
+				{
+					MutexAutoLock alock(mtx);
+					leases.emplace(base, std::move(l));
+				}
+				for(size_t i = 0; i < count; i++)
+					backend.queue(base + i);
+				continue; // maybe there's more
+			} else {
+				goto lost;
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+
+	backend.stopJoin();
+	std::cerr << "Completed " << n_leases << " leases, coordinator is done." << std::endl;
+	return 0;
+
+lost:
+	std::cerr << "Lost connection to the coordinator, exiting." << std::endl;
+	trace_dump_before_exit();
+	_Exit(1);
+}
@@ -1,15 +1,11 @@
 #include <endian.h>
 #include <arpa/inet.h>
+#include <strings.h> // strcasecmp()
 #include <sstream>
 
 #include "dns.hpp"
 #include "common.hpp"
 
-#define DECODE_ASSERT(expr) do { \
-	if(!(expr)) \
-		throw DecodeException(__FILE__, __LINE__, __PRETTY_FUNCTION__); \
-	} while(0)
-
 static void writeU8(uostream &s, uint8_t value)
 {
 	s.write((unsigned char*) &value, 1);
@@ -79,12 +75,28 @@ static std::string dns_type2str(enum DNSType type)
 			return "TXT";
 		case DNS_TYPE_AAAA:
 			return "AAAA";
+		case DNS_QTYPE_ANY:
+			return "ANY";
+		default:
+			return "";
+	}
+}
+
+static std::string dns_class2str(enum DNSClass class_)
+{
+	switch(class_) {
+		case DNS_CLASS_IN:
+			return "IN";
+		case DNS_CLASS_CH:
+			return "CH";
+		case DNS_QCLASS_ANY:
+			return "ANY";
 		default:
 			return "";
 	}
 }
 
-static enum DNSType dns_str2type(const std::string &s)
+enum DNSType dns_str2type(const std::string &s)
 {
 	if(s == "A")
 		return DNS_TYPE_A;
@@ -92,8 +104,14 @@ static enum DNSType dns_str2type(const std::string &s)
 		return DNS_TYPE_NS;
 	else if(s == "CNAME")
 		return DNS_TYPE_CNAME;
+	else if(s == "SOA")
+		return DNS_TYPE_SOA;
 	else if(s == "PTR")
 		return DNS_TYPE_PTR;
+	else if(s == "MX")
+		return DNS_TYPE_MX;
+	else if(s == "TXT")
+		return DNS_TYPE_TXT;
 	else if(s == "AAAA")
 		return DNS_TYPE_AAAA;
 	else if(s == "ANY")
@@ -159,6 +177,8 @@ std::string DNSName::toString() const
 void DNSName::parse(const std::string &s)
 {
 	labels.clear();
+	if(s == ".")
+		return;
 	std::string lbl;
 	for(char c : s) {
 		if(c == '.') {
@@ -172,6 +192,17 @@ void DNSName::parse(const std::string &s)
 	labels.shrink_to_fit();
 }
 
+bool DNSName::equals(const DNSName &other) const
+{
+	if(labels.size() != other.labels.size())
+		return false;
+	for(size_t i = 0; i < labels.size(); i++) {
+		if(strcasecmp(labels[i].c_str(), other.labels[i].c_str()) != 0)
+			return false;
+	}
+	return true;
+}
+
 
 void DNSQuestion::encode(uostream &s) const
 {
@@ -187,7 +218,12 @@ void DNSQuestion::decode(uistream &s, const ustring &whole_pkt)
 	qclass = (enum DNSClass) readU16(s);
 }
 
-void DNSQuestion::parse(const std::string &s)
+std::string DNSQuestion::toString() const
+{
+	return name.toString() + "\t" + dns_class2str(qclass) + "\t" + dns_type2str(qtype);
+}
+
+void DNSQuestion::parse(const std::string &s, std::vector<enum DNSType> *more_types)
 {
 	auto items = tokenize(s);
 	std::string class_, type;
@@ -203,8 +239,18 @@ void DNSQuestion::parse(const std::string &s)
 		DECODE_ASSERT(false);
 	}
 
-	qtype = dns_str2type(type);
+	// <type>,<type>,... if the caller takes more than one
+	size_t pos = type.find(',');
+	DECODE_ASSERT(pos == std::string::npos || more_types);
+	qtype = dns_str2type(type.substr(0, pos));
 	DECODE_ASSERT(qtype != (enum DNSType) 0);
+	while(pos != std::string::npos) {
+		size_t next = type.find(',', pos + 1);
+		enum DNSType t = dns_str2type(type.substr(pos + 1, next - pos - 1));
+		DECODE_ASSERT(t != (enum DNSType) 0);
+		more_types->push_back(t);
+		pos = next;
+	}
 
 	if(class_ == "IN")
 		qclass = DNS_CLASS_IN;
@@ -239,6 +285,11 @@ void DNSAnswer::decode(uistream &s, const ustring &whole_pkt)
 		case DNS_TYPE_PTR:
 			rdata.name.decode(s, whole_pkt);
 			break;
+		case DNS_TYPE_MX:
+			DECODE_ASSERT(rdlength >= 3);
+			rdata.preference = readU16(s);
+			rdata.name.decode(s, whole_pkt);
+			break;
 		default:
 			// TODO
 			s.seekg(rdlength, std::ios::cur);
@@ -251,12 +302,15 @@ std::string DNSAnswer::toString() const
 	std::ostringstream oss;
 	oss << name.toString() << "\t";
 	oss << (int) ttl << "\t";
-	if(class_ == DNS_CLASS_IN)
-		oss << "IN";
-	else if(class_ == DNS_CLASS_CH)
-		oss << "CH";
-	oss << "\t";
+	oss << dns_class2str(class_) << "\t";
 	oss << dns_type2str(type) << "\t";
+	oss << dataString();
+	return oss.str();
+}
+
+std::string DNSAnswer::dataString() const
+{
+	std::ostringstream oss;
 	switch(type) {
 		case DNS_TYPE_A: {
 			char dst[INET_ADDRSTRLEN];
@@ -273,6 +327,9 @@ std::string DNSAnswer::toString() const
 		case DNS_TYPE_PTR:
 			oss << rdata.name.toString();
 			break;
+		case DNS_TYPE_MX:
+			oss << rdata.preference << " " << rdata.name.toString();
+			break;
 		default:
 			oss << "???"; // TODO
 			break;
@@ -309,8 +366,8 @@ void DNSPacket::decode(const ustring &data)
 	DECODE_ASSERT((flags & 0x8000) != 0); // answer bit == 1
 	uint16_t qdcount = readU16(s);
 	uint16_t ancount = readU16(s);
-	readU16(s);
-	readU16(s);
+	uint16_t nscount = readU16(s);
+	uint16_t arcount = readU16(s);
 	questions.clear();
 	for(int i = 0; i < qdcount; i++) {
 		DNSQuestion q;
@@ -323,4 +380,16 @@ void DNSPacket::decode(const ustring &data)
 		a.decode(s, data);
 		answers.push_back(a);
 	}
+	authority.clear();
+	for(int i = 0; i < nscount; i++) {
+		DNSAnswer a;
+		a.decode(s, data);
+		authority.push_back(a);
+	}
+	additional.clear();
+	for(int i = 0; i < arcount; i++) {
+		DNSAnswer a;
+		a.decode(s, data);
+		additional.push_back(a);
+	}
 }
@@ -0,0 +1,90 @@
+#include <strings.h> // strcasecmp()
+#include <fnmatch.h>
+#include <sstream>
+
+#include "filter.hpp"
+
+static bool has_name(const DNSAnswer &a)
+{
+	return a.type == DNS_TYPE_NS || a.type == DNS_TYPE_CNAME ||
+		a.type == DNS_TYPE_PTR || a.type == DNS_TYPE_MX;
+}
+
+bool AnswerFilter::add(const std::string &expr)
+{
+	size_t pos = expr.find_first_of("!=~");
+	if(pos == std::string::npos)
+		return false;
+	Cond c;
+	const std::string field = expr.substr(0, pos);
+	if(field == "name")
+		c.field = FIELD_NAME;
+	else if(field == "type")
+		c.field = FIELD_TYPE;
+	else if(field == "data")
+		c.field = FIELD_DATA;
+	else
+		return false;
+
+	c.negate = expr[pos] == '!';
+	if(c.negate)
+		pos++;
+	if(pos >= expr.size() || (expr[pos] != '=' && expr[pos] != '~'))
+		return false;
+	c.glob = expr[pos] == '~';
+	const std::string value = expr.substr(pos + 1);
+	c.query = value == "@";
+	if(value.empty() || (c.field == FIELD_TYPE && (c.glob || c.query)) || (c.glob && c.query))
+		return false;
+
+	std::istringstream iss(value);
+	std::string v;
+	while(std::getline(iss, v, '|')) {
+		if(c.field == FIELD_TYPE) {
+			enum DNSType type = dns_str2type(v);
+			if(type == (enum DNSType) 0)
+				return false;
+			c.types.push_back(type);
+		} else {
+			c.values.push_back(v);
+		}
+	}
+	if(c.field == FIELD_TYPE)
+		conds.insert(conds.begin(), c);
+	else
+		conds.push_back(c);
+	return true;
+}
+
+bool AnswerFilter::matches(const DNSAnswer &a, const DNSQuestion &q) const
+{
+	// only formatted if an expression needs them
+	std::string name, data;
+	for(auto &c : conds) {
+		bool m = false;
+		if(c.field == FIELD_TYPE) {
+			for(auto type : c.types)
+				m |= a.type == type;
+		} else if(c.query) {
+			if(c.field == FIELD_NAME)
+				m = a.name.equals(q.name);
+			else
+				m = has_name(a) && a.rdata.name.equals(q.name);
+		} else {
+			std::string &s = c.field == FIELD_NAME ? name : data;
+			if(s.empty())
+				s = c.field == FIELD_NAME ? a.name.toString() : a.dataString();
+			for(auto &v : c.values) {
+				if(c.glob)
+					m = fnmatch(v.c_str(), s.c_str(), FNM_CASEFOLD) == 0;
+				else
+					m = strcasecmp(v.c_str(), s.c_str()) == 0;
+				if(m)
+					break;
+			}
+		}
+		if(m == c.negate)
+			return false;
+	}
+	return true;
+}
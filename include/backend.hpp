@@ -6,14 +6,22 @@
 #include <deque>
 #include <unordered_map>
 #include <mutex>
+#include <thread>
 #include <atomic>
+#include <map>
+#include <memory>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "socket.hpp"
+#include "metrics.hpp"
+#include "policy.hpp"
 
 using QueryID = intptr_t;
 
 struct SocketAddress;
+struct DNSName;
 struct DNSQuestion;
 struct DNSPacket;
 
@@ -21,60 +29,166 @@ struct Resolver
 {
 	SocketAddress addr;
 	unsigned capacity;
+	unsigned inflight;
 	uint16_t txid;
+	// statistics, protected by the backend mutex like everything else here
+	uint64_t n_sent = 0, n_recv = 0, n_timeout = 0, n_error = 0;
+	uint64_t rtt_sum_us = 0;
 
 	Resolver(const SocketAddress &addr, unsigned capacity) :
-		addr(addr), capacity(capacity), txid(0) {}
+		addr(addr), capacity(capacity), inflight(0), txid(0) {}
 	inline bool acquireCapacity() {
 		if (capacity == 0)
 			return false;
 		capacity--;
+		inflight++;
 		return true;
 	}
-	inline void restoreCapacity() { capacity++; }
+	inline void restoreCapacity() { capacity++; inflight--; }
+	// query was lost, the capacity it used is not given back
+	inline void dropCapacity() { inflight--; }
+	inline void penalize() {
+		if (capacity > 0)
+			capacity--;
+	}
+	inline bool isDead() const { return capacity == 0 && inflight == 0; }
 	inline uint16_t nextTxid() { return txid++; }
 };
 struct PendingQuery;
+class PcapWriter;
+struct ConsensusGroup;
+
+struct QueueEntry
+{
+	QueryID id;
+	unsigned attempts; // how often the query was sent already
+	size_t avoid_resolver; // resolver that failed the query last (or SIZE_MAX)
+	unsigned job;
+
+	QueueEntry(QueryID id, unsigned attempts=0, size_t avoid_resolver=SIZE_MAX, unsigned job=0) :
+		id(id), attempts(attempts), avoid_resolver(avoid_resolver), job(job) {}
+};
+
+// queues of multiple jobs, served by stride scheduling: every job gets
+// a share of the sends proportional to its weight, a job alone gets all
+class FairQueue
+{
+public:
+	void setWeight(unsigned job, unsigned weight);
+	void push(const QueueEntry &e);
+	bool pop(QueueEntry *e);
+	inline size_t size() const { return n; }
+	inline bool empty() const { return n == 0; }
+
+private:
+	struct Job {
+		std::deque<QueueEntry> queue;
+		unsigned weight = 1;
+		uint64_t pass = 0;
+	};
+
+	Job &getJob(unsigned job);
+
+	std::vector<Job> jobs;
+	uint64_t pass = 0; // of the job served last
+	size_t n = 0;
+};
 
 class QueryBackend {
 public:
 	QueryBackend(const std::vector<SocketAddress> &resolvers,
 		unsigned concurrent, time_t timeout, bool timeout_keep_cap=false);
 
+	// callback_fail is called once a query has exhausted its retries
 	void setCallbacks(
 		std::function<DNSQuestion(QueryID)> callback_question,
 		std::function<void(const DNSPacket&, QueryID)> callback_answer,
-		std::function<void(QueryID)> callback_timeout);
-
-	void queue(QueryID id);
+		std::function<void(QueryID)> callback_fail);
+	// callback_local is called before a query is sent for the first time,
+	// returning true means it was answered locally and is not sent
+	void setLocalCallback(std::function<bool(QueryID)> callback_local);
+	void setRetryPolicy(const RetryPolicy &policy);
+	void setHedgePolicy(const HedgePolicy &policy);
+	// not used for queries that have a route (see setRouteCallback)
+	void setAffinityPolicy(const AffinityPolicy &policy);
+	// send every query to this many distinct resolvers and only accept the
+	// majority answer, callback_conflict(id, agreeing, total) is called if
+	// the answers differ
+	void setConsensus(unsigned copies,
+		std::function<void(QueryID, unsigned, unsigned)> callback_conflict);
+	// callback_route fills in the resolvers a query may be sent to (instead of
+	// any resolver), a query is failed if all of them are dead
+	void setRouteCallback(std::function<void(QueryID, std::vector<size_t>*)> callback_route);
+	void setRecursionDesired(bool rd);
+	// every datagram sent and received is written to the capture
+	void setRecorder(PcapWriter *recorder);
+	// replaces the UDP socket, takes ownership
+	void setSocket(DatagramSocket *sock);
+	// can be called at any time, returns the resolver's index
+	size_t addResolver(const SocketAddress &addr);
+
+	void queue(QueryID id, unsigned job=0);
+	// instead of queueing everything up front, new queries (of job 0) are
+	// taken from callback_source whenever the send queue is empty, it
+	// returns false once there are none left
+	void setSource(std::function<bool(QueryID*)> callback_source);
+	// relative share of the sends for queries of this job (defaults to 1)
+	void setJobWeight(unsigned job, unsigned weight);
 
 	void start();
 	void getStats(uint32_t *n_sent, uint32_t *n_queue, uint32_t *n_recv,
 		bool reset=false);
+	inline const Metrics &getMetrics() const { return metrics; }
+	void getResolverStats(std::vector<ResolverStats> *stats);
 	void stopJoin();
 
 private:
 	void recv_thread();
 	void send_thread();
 	void timeout_thread();
-
-	Socket sock;
+	void retry(const QueueEntry &e);
+	void hedge(int64_t now);
+	void vote(ConsensusGroup *group);
+	void unpark(size_t rid);
+	void preferredResolvers(const DNSName &name, std::vector<size_t> *out);
+
+	std::unique_ptr<DatagramSocket> sock;
+	unsigned concurrent;
 	time_t timeout;
 	bool timeout_keep_cap;
+	RetryPolicy retry_policy;
+	HedgePolicy hedge_policy;
+	AffinityPolicy affinity_policy;
+	unsigned consensus = 1;
+	bool recursion_desired = true;
+	PcapWriter *recorder = nullptr;
+	int local_port = 0; // of sock, for the recorder
 
 	std::atomic<uint32_t> n_sent, n_recv;
+	Metrics metrics;
 	uint32_t n_queue;
 	bool should_exit;
 	std::thread *t_recv = nullptr, *t_send = nullptr, *t_timeout = nullptr;
 
 	std::function<DNSQuestion(QueryID)> callback_question = nullptr;
 	std::function<void(const DNSPacket&, QueryID)> callback_answer = nullptr;
-	std::function<void(QueryID)> callback_timeout = nullptr;
+	std::function<void(QueryID)> callback_fail = nullptr;
+	std::function<bool(QueryID)> callback_local = nullptr;
+	std::function<void(QueryID, unsigned, unsigned)> callback_conflict = nullptr;
+	std::function<void(QueryID, std::vector<size_t>*)> callback_route = nullptr;
+	std::function<bool(QueryID*)> callback_source = nullptr;
+	bool source_empty = false;
 
 	std::mutex mtx;
-	std::vector<Resolver> resolvers;
-	std::deque<QueryID> send_queue;
+	std::deque<Resolver> resolvers; // references stay valid when adding more
+	FairQueue send_queue;
+	std::multimap<int64_t, QueueEntry> delay_queue;
+	// routed queries waiting for a busy resolver (see unpark)
+	std::unordered_map<size_t, std::deque<QueueEntry>> parked;
+	std::deque<std::pair<QueueEntry, ustring>> hedge_queue;
 	std::unordered_map<ustring, PendingQuery*> pending;
+	std::unordered_map<ustring, int64_t> cancelled; // key -> time sent
+	std::vector<std::pair<uint64_t, size_t>> ring; // (point, resolver) sorted by point
 };
 
 #endif // BACKEND_HPP
@@ -0,0 +1,45 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+
+#include "dns.hpp"
+
+// answers learned during the run, so that names seen again
+// (e.g. CNAME targets) can be answered without another query
+class AnswerCache {
+public:
+	struct Entry {
+		enum DNSRcode rcode;
+		std::vector<DNSAnswer> records;
+	};
+
+	// case-insensitive key identifying a question
+	static std::string key(const DNSName &name, enum DNSType type, enum DNSClass class_);
+	static inline std::string key(const DNSQuestion &q) {
+		return key(q.name, q.qtype, q.qclass);
+	}
+
+	void insert(const std::string &key, const Entry &e);
+	// remembers the complete CNAME chains contained in an answer
+	void insertTargets(const DNSQuestion &q, const DNSPacket &pkt);
+	// nothing exists at or below a name that got NXDOMAIN (RFC 8020),
+	// lookups of such names return an NXDOMAIN entry
+	void insertNxdomain(const DNSName &name);
+	bool lookup(const DNSQuestion &q, Entry *e);
+
+	inline size_t hits() const { return n_hits; }
+	inline size_t nxdomainHits() const { return n_nxdomain_hits; }
+
+private:
+	std::mutex mtx;
+	std::unordered_map<std::string, Entry> entries;
+	std::unordered_set<std::string> nxdomain;
+	size_t n_hits = 0, n_nxdomain_hits = 0;
+};
+
+#endif // CACHE_HPP
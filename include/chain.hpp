@@ -0,0 +1,67 @@
+#ifndef CHAIN_HPP
+#define CHAIN_HPP
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+
+#include "backend.hpp"
+#include "dns.hpp"
+
+enum FollowRule {
+	FOLLOW_CNAME = 1, // CNAME target if the answer stopped at the alias
+	FOLLOW_NS = 2, // addresses of NS targets
+	FOLLOW_MX = 4, // addresses of MX targets
+	FOLLOW_PTR = 8, // addresses of PTR targets
+	FOLLOW_AAAA = 16, // AAAA for names that have an A record
+};
+
+// follow-ups of follow-ups are limited to this depth (CNAME loops)
+#define CHAIN_MAX_DEPTH 8
+
+// answers can spawn follow-up queries, their records are collected with the
+// ones of the query that started the chain until the whole chain is done
+class ChainFollower {
+public:
+	// follow-ups get ids counting up from first_id
+	ChainFollower(unsigned rules, QueryID first_id);
+	// comma-separated: cname, ns, mx, ptr, aaaa
+	static bool parseRules(const std::string &s, unsigned *rules);
+
+	inline bool isFollowUp(QueryID id) const { return id >= first_id; }
+	DNSQuestion question(QueryID id);
+	QueryID origin(QueryID id);
+
+	// records are what the query got (empty if it failed), the follow-ups
+	// it spawns are added to follow_ups. returns true once the chain of the
+	// query is done, *chain then holds its records, starting with the origin's
+	bool answer(QueryID id, const DNSQuestion &q, const std::vector<DNSAnswer> &records,
+		std::vector<QueryID> *follow_ups, std::vector<DNSAnswer> *chain);
+
+	inline size_t followUpCount() const { return questions.size(); }
+
+private:
+	struct Chain {
+		unsigned pending = 0; // follow-ups without an answer yet
+		std::vector<DNSAnswer> records;
+		std::unordered_set<std::string> asked;
+	};
+	struct FollowUp {
+		DNSQuestion q;
+		QueryID origin;
+		unsigned depth;
+	};
+
+	void collect(const DNSQuestion &q, const std::vector<DNSAnswer> &records,
+		std::vector<DNSQuestion> *res);
+
+	const unsigned rules;
+	const QueryID first_id;
+	std::mutex mtx;
+	std::unordered_map<QueryID, Chain> chains; // by origin
+	std::vector<FollowUp> questions; // index = id - first_id
+};
+
+#endif // CHAIN_HPP
@@ -0,0 +1,42 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKPOINT_INTERVAL_SEC 5
+
+// records which queries have completed, so an interrupted run can be resumed
+class Checkpoint {
+public:
+	Checkpoint(size_t n);
+
+	inline void markDone(size_t i) {
+		bits[i / 64].fetch_or(1ULL << (i % 64), std::memory_order_relaxed);
+	}
+	inline bool isDone(size_t i) const {
+		return bits[i / 64].load(std::memory_order_relaxed) & (1ULL << (i % 64));
+	}
+	size_t countDone() const;
+
+	// copy of the completion bitmap, taken together with the offsets
+	void snapshot(std::vector<uint64_t> *done) const;
+	// the offsets tell how much of the output files belongs to completed queries,
+	// the data up to them has to be on disk already (see sync_file)
+	bool save(const std::string &path, uint64_t out_offset, uint64_t fail_offset,
+		const std::vector<uint64_t> &done) const;
+	bool load(const std::string &path, uint64_t *out_offset, uint64_t *fail_offset);
+
+private:
+	size_t n, words;
+	std::unique_ptr<std::atomic<uint64_t>[]> bits;
+};
+
+// fsync() of the file at path
+bool sync_file(const std::string &path);
+
+#endif // CHECKPOINT_HPP
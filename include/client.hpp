@@ -0,0 +1,53 @@
+#ifndef CLIENT_HPP
+#define CLIENT_HPP
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+#include <time.h>
+
+// the backend stays out of the installed headers, only these are needed
+#include "policy.hpp"
+#include "metrics.hpp"
+#include "socket.hpp"
+#include "dns.hpp"
+
+struct DNSResult {
+	// false if the query failed permanently (no usable answer after all retries)
+	bool ok;
+	// the decoded answer, only valid if ok
+	DNSPacket packet;
+};
+
+// asynchronous resolver for use as a library: questions can be submitted at
+// any time, results are delivered to a callback or through a future.
+// callbacks run on the backend's threads and should not block.
+class DNSClient {
+public:
+	using Callback = std::function<void(const DNSResult&)>;
+
+	DNSClient(const std::vector<SocketAddress> &resolvers,
+		unsigned concurrent=2, time_t timeout=6);
+	// outstanding queries are completed as failed
+	~DNSClient();
+
+	// must be called before start()
+	void setRetryPolicy(const RetryPolicy &policy);
+	void setHedgePolicy(const HedgePolicy &policy);
+	void setAffinityPolicy(const AffinityPolicy &policy);
+
+	void start();
+	void submit(const DNSQuestion &q, Callback callback);
+	std::future<DNSResult> submit(const DNSQuestion &q);
+	size_t outstanding();
+	const Metrics &getMetrics() const;
+	void getResolverStats(std::vector<ResolverStats> *stats);
+	void stop();
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
+
+#endif // CLIENT_HPP
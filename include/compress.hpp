@@ -0,0 +1,53 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+// uncompressed size of every gzip member
+#define GZIP_BLOCK_SIZE (1 << 20)
+
+// writes a gzip file made of independent members, each containing one block
+// of output. the compression happens on a separate thread, writers only copy.
+// members can be decompressed in parallel and a truncated file loses at most
+// the last one. sync() (i.e. flush) ends the current member and waits until
+// everything is on disk, the position then is the compressed file size.
+class GzipStreamBuf : public std::streambuf {
+public:
+	GzipStreamBuf(int level=6);
+	~GzipStreamBuf();
+
+	bool open(const std::string &path, bool append);
+
+protected:
+	int_type overflow(int_type c) override;
+	int sync() override;
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+		std::ios_base::openmode which) override;
+
+private:
+	void submit();
+	void compress_thread();
+
+	int level;
+	int fd = -1;
+	std::vector<char> buf;
+
+	std::mutex mtx;
+	std::condition_variable cv, cv_idle;
+	std::deque<std::string> queue;
+	bool busy = false, failed = false, should_exit = false;
+	uint64_t written = 0; // compressed bytes in the file
+	std::thread *thread = nullptr;
+};
+
+// true if the path asks for compressed output
+bool is_gzip_path(const std::string &path);
+
+#endif // COMPRESS_HPP
@@ -0,0 +1,30 @@
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct SocketAddress;
+struct QueryOptions;
+struct QueryList;
+
+/*
+	Protocol (line based, over a unix socket):
+	client: questions in the format of query files, followed by an empty line
+	daemon: "<index>\tA\t<record>" for each record of an answer,
+	        "<index>\tF" for queries that failed,
+	        "<index>\tE" for lines that are not a valid question,
+	        as they complete and in any order, then DONE <answered> <failed>
+	Further batches can be sent on the same connection afterwards.
+*/
+
+// resolves batches submitted over the unix socket at path until interrupted,
+// resolver state (capacity, latency) is kept between batches
+int daemon_main(const QueryOptions &opts, const std::string &path,
+	std::vector<SocketAddress> &resolvers);
+// sends the queries to the daemon at path and writes the answers
+int submit_main(std::ostream &outfile, const QueryOptions &opts,
+	const std::string &path, QueryList &queries);
+
+#endif // DAEMON_HPP
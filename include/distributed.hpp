@@ -0,0 +1,33 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct SocketAddress;
+struct QueryOptions;
+struct QueryList;
+
+/*
+	Protocol (line based, over TCP):
+	worker: LEASE
+	coordinator: LEASE <lease id> <count>, followed by count questions
+	         or: WAIT (everything is leased out, ask again later)
+	         or: DONE
+	worker: RESULT <lease id> <lines> <sent> <received> <timeouts> <retries>,
+	        followed by lines of "<index>\tA\t<record>" or "<index>\tF"
+	coordinator: OK
+*/
+
+// number of leases a worker works on at the same time
+#define WORKER_LEASES 2
+
+// hands out the queries to workers and writes their results
+int coordinator_main(std::ostream &outfile, const QueryOptions &opts,
+	const SocketAddress &listen_addr, QueryList &queries);
+// resolves leases from the coordinator until it has nothing left
+int worker_main(const QueryOptions &opts, const SocketAddress &coordinator,
+	std::vector<SocketAddress> &resolvers);
+
+#endif // DISTRIBUTED_HPP
@@ -17,6 +17,11 @@ private:
 	std::string text;
 };
 
+#define DECODE_ASSERT(expr) do { \
+	if(!(expr)) \
+		throw DecodeException(__FILE__, __LINE__, __PRETTY_FUNCTION__); \
+	} while(0)
+
 /*
 	https://tools.ietf.org/html/rfc1035 General
 	https://tools.ietf.org/html/rfc3596 IPv6 types
@@ -33,6 +38,8 @@ struct DNSName {
 
 	std::string toString() const;
 	void parse(const std::string &s);
+	// names are case-insensitive
+	bool equals(const DNSName &other) const;
 };
 
 enum DNSType {
@@ -57,6 +64,15 @@ enum DNSClass {
 	DNS_QCLASS_ANY = 255, // any class
 };
 
+enum DNSRcode {
+	DNS_RCODE_NOERROR = 0, // no error condition
+	DNS_RCODE_FORMERR = 1, // format error
+	DNS_RCODE_SERVFAIL = 2, // server failure
+	DNS_RCODE_NXDOMAIN = 3, // name error
+	DNS_RCODE_NOTIMP = 4, // not implemented
+	DNS_RCODE_REFUSED = 5, // refused
+};
+
 struct DNSQuestion {
 	DNSName name;
 	enum DNSType qtype;
@@ -65,7 +81,10 @@ struct DNSQuestion {
 	void encode(uostream &s) const;
 	void decode(uistream &s, const ustring &whole_pkt);
 
-	void parse(const std::string &s);
+	std::string toString() const;
+	// a comma-separated list of types is only valid with more_types, which
+	// receives the ones after the first
+	void parse(const std::string &s, std::vector<enum DNSType> *more_types=nullptr);
 };
 
 struct DNSAnswer {
@@ -78,12 +97,14 @@ struct DNSAnswer {
 			struct in_addr addr4; // A
 			struct in6_addr addr6; // AAAA
 		};
-		DNSName name; // NS, CNAME, PTR
+		uint16_t preference; // MX
+		DNSName name; // NS, CNAME, PTR, MX
 	} rdata;
 
 	void decode(uistream &s, const ustring &whole_pkt);
 
 	std::string toString() const;
+	std::string dataString() const; // only the rdata part of toString()
 };
 
 struct DNSPacket {
@@ -91,9 +112,17 @@ struct DNSPacket {
 	uint16_t flags;
 	std::vector<DNSQuestion> questions;
 	std::vector<DNSAnswer> answers;
+	std::vector<DNSAnswer> authority;
+	std::vector<DNSAnswer> additional;
 
 	void encode(ustring *data) const;
 	void decode(const ustring &data);
+
+	inline enum DNSRcode rcode() const { return (enum DNSRcode) (flags & 0xf); }
+	inline bool authoritative() const { return (flags & 0x0400) != 0; }
 };
 
+// 0 if the type is unknown
+enum DNSType dns_str2type(const std::string &s);
+
 #endif // DNS_HPP
@@ -0,0 +1,51 @@
+#ifndef DNSHAMMER_H
+#define DNSHAMMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dnshammer dnshammer;
+
+struct dnshammer_record {
+	const char *name;
+	uint16_t type;
+	uint16_t class_;
+	int32_t ttl;
+	// A: first 4 bytes, AAAA: all 16 bytes
+	unsigned char addr[16];
+	// NS, CNAME, PTR: target name, NULL otherwise
+	const char *target;
+};
+
+// rcode is -1 if the query failed permanently, records and the strings
+// inside them are only valid for the duration of the call.
+// called from an internal thread, must not block.
+typedef void (*dnshammer_callback)(int rcode, const struct dnshammer_record *records,
+	size_t count, void *userdata);
+
+// resolvers are given as "ip", "ipv4:port" or "[ipv6]:port".
+// returns NULL if a resolver address is invalid.
+dnshammer *dnshammer_new(const char *const *resolvers, size_t count,
+	unsigned concurrent, unsigned timeout);
+// a query fails after max_retries retries (10 by default), each waiting
+// backoff * attempts seconds, retry_errors also retries SERVFAIL and REFUSED
+// answers with another resolver. only before the first dnshammer_submit().
+void dnshammer_set_retries(dnshammer *h, unsigned max_retries, unsigned backoff,
+	int retry_errors);
+// name must be fully qualified (trailing dot), type is the numeric QTYPE.
+// returns 0 on success, -1 if the name is invalid.
+int dnshammer_submit(dnshammer *h, const char *name, uint16_t type,
+	dnshammer_callback callback, void *userdata);
+size_t dnshammer_outstanding(dnshammer *h);
+// outstanding queries complete with rcode -1 before this returns
+void dnshammer_free(dnshammer *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DNSHAMMER_H
@@ -0,0 +1,36 @@
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include <vector>
+#include <string>
+
+#include "dns.hpp"
+
+// decides which records are written, it looks at the decoded records so that
+// the ones that are dropped never get formatted
+class AnswerFilter {
+public:
+	// <field><op><value>, field is name, type or data (address or target name),
+	// op is = (any of the |-separated values), != (none of them), ~ (glob) or !~.
+	// @ as the value stands for the queried name
+	bool add(const std::string &expr);
+	inline bool empty() const { return conds.empty(); }
+
+	// a record has to match all expressions
+	bool matches(const DNSAnswer &a, const DNSQuestion &q) const;
+
+private:
+	enum Field { FIELD_NAME, FIELD_TYPE, FIELD_DATA };
+	struct Cond {
+		Field field;
+		bool glob;
+		bool negate;
+		bool query; // value is @
+		std::vector<std::string> values;
+		std::vector<enum DNSType> types;
+	};
+
+	std::vector<Cond> conds; // the ones on the type come first, they are cheap
+};
+
+#endif // FILTER_HPP
@@ -0,0 +1,68 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <atomic>
+#include <stdint.h>
+
+// HDR-style histogram: 8 linear sub-buckets per power of two,
+// which keeps the relative error below 12.5% over the whole range
+class LatencyHistogram {
+public:
+	static constexpr int SUB_BITS = 3;
+	static constexpr int SUB_COUNT = 1 << SUB_BITS;
+	static constexpr int BUCKETS = (32 - SUB_BITS + 1) * SUB_COUNT;
+
+	LatencyHistogram() { reset(); }
+
+	inline void add(uint32_t v) {
+		buckets[index(v)].fetch_add(1, std::memory_order_relaxed);
+		total.fetch_add(1, std::memory_order_relaxed);
+		total_sum.fetch_add(v, std::memory_order_relaxed);
+	}
+	inline uint64_t count() const { return total.load(std::memory_order_relaxed); }
+	inline uint64_t sum() const { return total_sum.load(std::memory_order_relaxed); }
+	inline uint64_t bucketCount(int i) const {
+		return buckets[i].load(std::memory_order_relaxed);
+	}
+	void reset() {
+		for(int i = 0; i < BUCKETS; i++)
+			buckets[i] = 0;
+		total = 0;
+		total_sum = 0;
+	}
+
+	// returns the upper bound of the bucket containing the given percentile
+	uint32_t percentile(float pct) const {
+		uint64_t n = count();
+		if(n == 0)
+			return 0;
+		uint64_t want = (uint64_t) (n * (pct / 100.f)), seen = 0;
+		for(int i = 0; i < BUCKETS; i++) {
+			seen += bucketCount(i);
+			if(seen > want)
+				return upperBound(i);
+		}
+		return upperBound(BUCKETS - 1);
+	}
+
+	static inline int index(uint32_t v) {
+		if(v < SUB_COUNT)
+			return v;
+		int msb = 31 - __builtin_clz(v);
+		int shift = msb - SUB_BITS;
+		return (shift + 1) * SUB_COUNT + ((v >> shift) & (SUB_COUNT - 1));
+	}
+	static inline uint32_t upperBound(int i) {
+		if(i < SUB_COUNT)
+			return i;
+		int shift = i / SUB_COUNT - 1;
+		uint64_t v = ((uint64_t) (SUB_COUNT + i % SUB_COUNT + 1) << shift) - 1;
+		return v > UINT32_MAX ? UINT32_MAX : v;
+	}
+
+private:
+	std::atomic<uint64_t> buckets[BUCKETS];
+	std::atomic<uint64_t> total, total_sum;
+};
+
+#endif // HISTOGRAM_HPP
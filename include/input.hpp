@@ -0,0 +1,20 @@
+#ifndef INPUT_HPP
+#define INPUT_HPP
+
+#include <istream>
+#include <string>
+#include <set>
+#include <vector>
+
+struct SocketAddress;
+struct QueryList;
+
+bool parse_resolver_list(std::istream &s, std::vector<SocketAddress> &res);
+bool parse_query_list(std::istream &s, QueryList &res);
+// see dnshammer compile
+bool is_compiled_query_list(const std::string &path);
+bool compile_query_list(const QueryList &queries, const std::string &path);
+bool map_query_list(const std::string &path, QueryList &res);
+void trim(std::string &s, const std::set<char> &trimchars);
+
+#endif // INPUT_HPP
@@ -0,0 +1,87 @@
+#ifndef ITERATIVE_HPP
+#define ITERATIVE_HPP
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+#include "backend.hpp"
+#include "dns.hpp"
+
+// a query is given up after following this many referrals
+#define ITERATIVE_MAX_REFERRALS 40
+// limit for lookups of name server addresses that need more such lookups
+#define ITERATIVE_MAX_DEPTH 4
+
+// resolves queries by asking the authoritative servers directly, starting
+// at the root (or a stub zone) and following referrals.
+// learned zone cuts and name server addresses are kept for the whole run.
+class IterativeResolver {
+public:
+	// takes over the routing and callbacks of the backend
+	IterativeResolver(QueryBackend &backend);
+
+	// servers that are authoritative for zone, used as starting point
+	void addStub(const DNSName &zone, const std::vector<SocketAddress> &servers);
+	void addRootHints();
+
+	// same meaning as in QueryBackend, only final answers are passed on
+	void setCallbacks(
+		std::function<DNSQuestion(QueryID)> callback_question,
+		std::function<void(const DNSPacket&, QueryID)> callback_answer,
+		std::function<void(QueryID)> callback_fail);
+	void setLocalCallback(std::function<bool(QueryID)> callback_local);
+
+	size_t zoneCount();
+	size_t lookupCount();
+
+private:
+	struct Zone {
+		DNSName name;
+		std::vector<size_t> servers;
+		// name servers without known address, tried one after another
+		std::vector<DNSName> unresolved;
+		bool resolving = false;
+		std::vector<QueryID> waiting; // queries waiting for an address
+	};
+	// internal lookup of a name server address
+	struct Lookup {
+		DNSQuestion question;
+		size_t zone;
+		unsigned depth;
+	};
+
+	DNSQuestion question(QueryID id);
+	void route(QueryID id, std::vector<size_t> *res);
+	void answer(const DNSPacket &pkt, QueryID id);
+	void fail(QueryID id);
+
+	size_t findZone(const DNSName &name);
+	size_t getZone(const DNSName &name);
+	size_t getResolver(const SocketAddress &addr);
+	bool referral(const DNSPacket &pkt, QueryID id, const DNSName &qname,
+		std::vector<QueryID> *requeue, std::vector<QueryID> *failed);
+	void resolveNext(size_t zone, unsigned depth, std::vector<QueryID> *failed);
+	void finishLookup(QueryID id, const DNSPacket *pkt);
+
+	QueryBackend &backend;
+
+	std::function<DNSQuestion(QueryID)> callback_question;
+	std::function<void(const DNSPacket&, QueryID)> callback_answer;
+	std::function<void(QueryID)> callback_fail;
+
+	std::mutex mtx;
+	std::deque<Zone> zones;
+	std::unordered_map<std::string, size_t> zone_index; // name -> zone
+	std::unordered_map<std::string, std::vector<size_t>> hosts; // name server -> resolvers
+	std::unordered_map<ustring, size_t> addrs; // address -> resolver
+	std::unordered_map<QueryID, unsigned> referrals; // only queries that had one
+	std::unordered_map<QueryID, Lookup> lookups; // negative ids
+	QueryID next_lookup = -1;
+	size_t n_lookups = 0;
+};
+
+#endif // ITERATIVE_HPP
@@ -0,0 +1,54 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "histogram.hpp"
+
+// counters are only ever incremented, most of them by a single thread,
+// relaxed atomics keep them cheap enough to always have them enabled
+struct Counter {
+	std::atomic<uint64_t> v;
+
+	Counter() : v(0) {}
+	inline void operator++(int) { v.fetch_add(1, std::memory_order_relaxed); }
+	inline void operator+=(uint64_t n) { v.fetch_add(n, std::memory_order_relaxed); }
+	inline uint64_t get() const { return v.load(std::memory_order_relaxed); }
+};
+
+struct Metrics {
+	Counter sent, received, timeouts, retries, failed, hedged, local;
+	Counter late, decode_errors, spilled, degraded;
+	Counter lock_wait_us;
+	Counter rcodes[16];
+	LatencyHistogram rtt; // microseconds
+};
+
+struct ResolverStats {
+	std::string addr;
+	uint64_t sent, received, timeouts, errors;
+	uint64_t rtt_sum_us;
+	unsigned capacity;
+};
+
+std::string metrics_json(const Metrics &m, const std::vector<ResolverStats> &res);
+std::string metrics_prometheus(const Metrics &m, const std::vector<ResolverStats> &res);
+std::string metrics_summary(const Metrics &m, const std::vector<ResolverStats> &res);
+
+// periodically exports metrics to a file or a unix socket ("unix:<path>")
+class MetricsExporter {
+public:
+	~MetricsExporter();
+	bool open(const std::string &target);
+	void update(const Metrics &m, const std::vector<ResolverStats> &res);
+
+private:
+	std::string path;
+	bool json = false;
+	int listen_fd = -1;
+};
+
+#endif // METRICS_HPP
@@ -0,0 +1,53 @@
+#ifndef PCAP_HPP
+#define PCAP_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <mutex>
+
+#include "common.hpp"
+#include "socket.hpp"
+
+/*
+	https://wiki.wireshark.org/Development/LibpcapFileFormat
+	Packets are stored as raw IPv4 or IPv6 (LINKTYPE_RAW) with a UDP header.
+	Our own address is not known, so it is written as unspecified (0.0.0.0 or ::).
+*/
+
+struct CapturedPacket {
+	int64_t time_us; // since the epoch
+	bool outgoing; // direction, taken from the QR bit of the DNS header
+	SocketAddress remote;
+	ustring payload;
+};
+
+// records datagrams to a capture file, can be used from multiple threads
+class PcapWriter {
+public:
+	~PcapWriter();
+
+	bool open(const std::string &path);
+	void write(const ustring &payload, const SocketAddress &remote, int local_port, bool outgoing);
+	void close();
+
+private:
+	std::mutex mtx;
+	FILE *f = nullptr;
+};
+
+class PcapReader {
+public:
+	~PcapReader();
+
+	bool open(const std::string &path);
+	// returns false at the end of the file, skips packets that aren't UDP
+	bool next(CapturedPacket *pkt);
+
+private:
+	FILE *f = nullptr;
+	bool swapped = false;
+	bool nsec = false;
+};
+
+#endif // PCAP_HPP
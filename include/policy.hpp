@@ -0,0 +1,39 @@
+#ifndef POLICY_HPP
+#define POLICY_HPP
+
+#include <limits.h>
+#include <time.h>
+
+struct RetryPolicy
+{
+	// a query is given up after it was retried this many times
+	unsigned max_retries = UINT_MAX;
+	// seconds to wait before a retry is sent, multiplied by the attempt count
+	time_t backoff = 0;
+	// also retry SERVFAIL and REFUSED answers (with a different resolver)
+	bool retry_errors = false;
+};
+
+struct HedgePolicy
+{
+	bool enabled = false;
+	// queries outstanding longer than this latency percentile are
+	// duplicated to a different resolver, the first answer wins
+	float percentile = 95.f;
+	// hedged sends may not exceed this fraction of all sends
+	float budget = 0.05f;
+	// only hedge once the send queue has run empty (tail of the run)
+	bool when_drained = false;
+};
+
+struct AffinityPolicy
+{
+	// queries are grouped into zones by the last this many labels of their
+	// name (e.g. 2 for example.com, 2 + n for n nibbles of ip6.arpa), 0 = off
+	unsigned labels = 0;
+	// a zone's queries go to this many resolvers picked by consistent hashing,
+	// so that their caches stay warm, others are only used once these are busy
+	unsigned resolvers = 2;
+};
+
+#endif // POLICY_HPP
@@ -2,16 +2,124 @@
 #define QUERY_HPP
 
 #include <vector>
+#include <unordered_map>
 #include <ostream>
+#include <string>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "dns.hpp"
 
 struct SocketAddress;
-struct DNSQuestion;
+class Checkpoint;
+class AnswerFilter;
 
 #define TIMEOUT_SEC 6
 
-int query_main(std::ostream &outfile,
-	bool quiet, unsigned concurrent,
+struct QueryList {
+	std::vector<DNSQuestion> questions;
+	// once a line asks for more than one type ("<name> A,AAAA,MX") questions
+	// holds one entry per line and every query is a line and one of its types
+	std::vector<uint32_t> line;
+	std::vector<uint16_t> types;
+	// index -> number of additional times the question appeared in the input
+	std::unordered_map<size_t, unsigned> duplicates;
+
+	// a compiled query file (see map_query_list) is decoded on access instead
+	const uint64_t *index = nullptr; // offsets into data, n_mapped + 1 of them
+	const unsigned char *data = nullptr;
+	size_t data_size = 0, n_mapped = 0;
+
+	inline bool mapped() const { return index != nullptr; }
+	inline bool multiType() const { return !line.empty(); }
+	inline size_t size() const {
+		return mapped() ? n_mapped : multiType() ? line.size() : questions.size();
+	}
+	inline bool empty() const { return size() == 0; }
+	inline DNSQuestion operator[](size_t i) const {
+		if(mapped())
+			return decode(i);
+		if(!multiType())
+			return questions[i];
+		DNSQuestion q = questions[line[i]];
+		q.qtype = (enum DNSType) types[i];
+		return q;
+	}
+	// avoids the copy of operator[] for lists that hold their questions,
+	// others decode the question into *tmp
+	inline const DNSQuestion &get(size_t i, DNSQuestion *tmp) const {
+		if(!mapped() && !multiType())
+			return questions[i];
+		*tmp = (*this)[i];
+		return *tmp;
+	}
+	DNSQuestion decode(size_t i) const;
+	inline unsigned copies(size_t i) const {
+		auto it = duplicates.find(i);
+		return it == duplicates.end() ? 1 : it->second + 1;
+	}
+};
+
+// input file run alongside others, see --job
+struct QueryJob {
+	std::string name;
+	unsigned weight = 1; // share of the sends relative to the other jobs
+	std::ostream *outfile = nullptr;
+	size_t first = 0, count = 0; // its range in the query list
+};
+
+enum WildcardMode {
+	WILDCARDS_OFF,
+	WILDCARDS_SKIP, // don't send queries below a wildcard
+	WILDCARDS_FILTER, // drop answers that match the wildcard
+};
+
+struct QueryOptions {
+	bool quiet = false;
+	unsigned concurrent = 2;
+	unsigned max_retries = 10;
+	time_t backoff = 0;
+	bool retry_errors = false;
+	float hedge_percentile = 0; // 0 = hedging disabled
+	float hedge_budget = 5;
+	bool hedge_tail = false;
+	unsigned affinity_labels = 0; // 0 = queries go to any resolver
+	unsigned affinity_resolvers = 2;
+	unsigned consensus = 1; // number of resolvers every query is sent to
+	std::ostream *failfile = nullptr; // receives queries that failed permanently
+	Checkpoint *checkpoint = nullptr;
+	std::string checkpoint_file;
+	std::string outfile_path, failfile_path; // synced before every checkpoint
+	std::string metrics_target; // file or "unix:<path>"
+	bool iterative = false; // ask authoritative servers directly
+	std::string stub_zone; // zone the resolvers are authoritative for (iterative)
+	unsigned lease_size = 1000; // queries per lease (coordinator)
+	time_t lease_time = 300; // seconds until a lease is given to another worker
+	std::vector<QueryJob> jobs; // if empty all queries belong to one job
+	WildcardMode wildcards = WILDCARDS_OFF;
+	bool nxdomain_cut = false; // don't send queries below names that got NXDOMAIN
+	bool parents_first = false; // send queries with fewer labels first
+	std::string record_file; // capture of all sent and received datagrams
+	unsigned follow = 0; // FollowRule bits, answers spawn follow-up queries
+	std::string store_file; // answers of previous runs, only expired ones are sent
+	bool changes_only = false; // only write answers that differ from the store
+	AnswerFilter *filter = nullptr; // records it doesn't match are not written
+	std::string xdp_interface; // send and receive through AF_XDP (WITH_XDP only)
+};
+
+class QueryBackend;
+struct RetryPolicy;
+struct HedgePolicy;
+struct AffinityPolicy;
+
+int query_main(std::ostream &outfile, const QueryOptions &opts,
 	std::vector<SocketAddress> &resolvers,
-	std::vector<DNSQuestion> &queries);
+	QueryList &queries);
+// applies the retry, hedging and affinity options
+void configure_backend(QueryBackend &backend, const QueryOptions &opts);
+RetryPolicy retry_policy(const QueryOptions &opts);
+HedgePolicy hedge_policy(const QueryOptions &opts);
+AffinityPolicy affinity_policy(const QueryOptions &opts);
 
 #endif // QUERY_HPP
@@ -5,6 +5,7 @@
 #include <netinet/in.h>
 #include <errno.h>
 #include <exception>
+#include <string>
 
 #include "common.hpp"
 
@@ -22,12 +23,30 @@ struct SocketAddress {
 
 	ustring getIPBytes() const;
 	bool parseIP(const std::string &s);
+	void setIPv4(const struct in_addr &ip);
+	// accepts "ip", "ipv4:port" and "[ipv6]:port"
+	bool parse(const std::string &s, int default_port);
+	std::string toString(bool with_port=false) const;
 	int getPort() const;
 	void setPort(int port);
 };
 
+// what the query backend sends and receives datagrams with
+class DatagramSocket {
+public:
+	virtual ~DatagramSocket() {}
+
+	virtual void sendto(const ustring &data, const SocketAddress &host) = 0;
+	// data is left empty if nothing usable was received
+	virtual void recvfrom(size_t n, ustring *data, struct SocketAddress &source) = 0;
+	// returns POLLNVAL once closed
+	virtual short poll(short events, int timeout) = 0;
+	virtual int getLocalPort() = 0;
+	virtual void close() = 0;
+};
+
 // represents an IPv6 UDP socket
-class Socket {
+class Socket : public DatagramSocket {
 public:
 	Socket();
 	~Socket();
@@ -35,10 +54,25 @@ public:
 	void sendto(const ustring &data, const SocketAddress &host);
 	void recvfrom(size_t n, ustring *data, struct SocketAddress &source);
 	short poll(short events, int timeout);
+	int getLocalPort();
 	void close();
 
 private:
 	int fd;
 };
 
+// buffered line-based reading and writing on a stream socket (TCP or unix)
+class LineConn {
+public:
+	LineConn(int fd) : fd(fd) {}
+	~LineConn();
+
+	bool readLine(std::string *line);
+	bool write(const std::string &data);
+
+private:
+	int fd;
+	std::string buf;
+};
+
 #endif // SOCKET_HPP
@@ -0,0 +1,54 @@
+#ifndef STORE_HPP
+#define STORE_HPP
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include "dns.hpp"
+
+// negative answers without an SOA record are kept this long (seconds)
+#define STORE_NEGATIVE_TTL 3600
+// a run saves the store this often (seconds), not only at the end
+#define STORE_SAVE_INTERVAL_SEC 60
+
+// answers of previous runs keyed by question (see AnswerCache::key), so that a
+// rescan only sends the queries whose answers expired or that failed last time
+class ResultStore {
+public:
+	struct Entry {
+		int64_t time = 0; // when the answer arrived (unix time)
+		uint32_t ttl = 0; // lowest TTL of the records, or the negative TTL
+		bool failed = false; // no usable answer the last time it was sent
+		enum DNSRcode rcode = DNS_RCODE_NOERROR;
+		std::vector<std::string> records; // as written to the output
+
+		inline bool fresh(int64_t now) const { return !failed && time + ttl > now; }
+	};
+
+	using Snapshot = std::vector<std::pair<std::string, Entry>>;
+
+	// a file that doesn't exist yet is an empty store
+	bool load(const std::string &path);
+	// copies the entries, so that updates only wait for the copy
+	void snapshot(Snapshot *s);
+	// sorts the snapshot and writes it
+	static bool save(const std::string &path, Snapshot &s);
+
+	bool lookup(const std::string &key, Entry *e);
+	// returns whether the records differ from the stored ones (ignoring TTLs),
+	// *had_records tells if there were any before
+	bool update(const std::string &key, const DNSPacket &pkt, int64_t now, bool *had_records);
+	// the stored records are kept, but the query is sent again next time
+	void markFailed(const std::string &key);
+
+	inline size_t size() const { return entries.size(); }
+
+private:
+	std::mutex mtx;
+	std::unordered_map<std::string, Entry> entries;
+};
+
+#endif // STORE_HPP
@@ -0,0 +1,53 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <stdint.h>
+#include <string>
+
+/*
+	https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+	Spans of the hot paths are recorded into a ring buffer per thread and
+	written as Chrome trace event JSON, which chrome://tracing and Perfetto open.
+	Only compiled in with WITH_TRACE (make TRACE=1), TRACE_SPAN does nothing otherwise.
+*/
+
+#define TRACE_EVENTS 65536 // per thread, older spans are overwritten
+
+#ifdef WITH_TRACE
+
+// records the time from construction until the end of the scope
+class TraceSpan {
+public:
+	TraceSpan(const char *name);
+	~TraceSpan();
+
+private:
+	const char *name; // must be a literal
+	int64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_THREAD(name) trace_thread_name(name)
+
+void trace_thread_name(const char *name);
+// writes all spans when the program exits
+void trace_dump_at_exit(const std::string &path);
+bool trace_dump(const std::string &path);
+// whether trace_dump_at_exit was called
+bool trace_requested();
+// _Exit() skips atexit, so call this right before it
+void trace_dump_before_exit();
+
+#else
+
+#define TRACE_SPAN(name) do {} while(0)
+#define TRACE_THREAD(name) do {} while(0)
+
+static inline bool trace_requested() { return false; }
+static inline void trace_dump_before_exit() {}
+
+#endif
+
+#endif // TRACE_HPP
@@ -0,0 +1,24 @@
+#ifndef WALK_HPP
+#define WALK_HPP
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "dns.hpp"
+
+struct SocketAddress;
+struct QueryOptions;
+
+// number of nibbles in a complete ip6.arpa name
+#define WALK_MAX_NIBBLES 32
+
+// reads ip6.arpa names or nibble-aligned IPv6 prefixes (2001:db8::/32), one per line
+bool parse_walk_list(std::istream &s, std::vector<DNSName> &res);
+// finds the PTR records below the starting points by walking the ip6.arpa tree:
+// a node that exists (NOERROR) has its 16 children queried, NXDOMAIN means
+// nothing exists below it (RFC 8020)
+int walk_main(std::ostream &outfile, const QueryOptions &opts,
+	std::vector<SocketAddress> &resolvers, const std::vector<DNSName> &start);
+
+#endif // WALK_HPP
@@ -0,0 +1,68 @@
+#ifndef WILDCARD_HPP
+#define WILDCARD_HPP
+
+#include <vector>
+#include <string>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <random>
+
+#include "backend.hpp"
+#include "dns.hpp"
+
+// parents with fewer queries below them are not worth a probe
+#define WILDCARD_MIN_QUERIES 8
+
+// finds wildcard records by asking for a random name below the parent of
+// the queried names before sending the real queries.
+// the parent is probed separately for every query type.
+class WildcardDetector {
+public:
+	// probes get ids counting up from first_probe
+	WildcardDetector(QueryID first_probe);
+
+	// must be called for every query before the first hold()
+	void count(const DNSQuestion &q);
+	// returns true if the query has to wait for a probe of its parent,
+	// it is released by finishProbe() later
+	bool hold(QueryID id, const DNSQuestion &q);
+	// moves the probes created by hold() since the last call into res
+	void takeProbes(std::vector<QueryID> *res);
+
+	inline bool isProbe(QueryID id) const { return id >= first_probe; }
+	DNSQuestion probe(QueryID id);
+	// pkt is nullptr if the probe failed, returns the queries that were held
+	// and whether the parent has a wildcard
+	void finishProbe(QueryID id, const DNSPacket *pkt,
+		std::vector<QueryID> *released, bool *wildcard);
+
+	// true if the answer consists only of records of the wildcard
+	bool matches(const DNSQuestion &q, const DNSPacket &pkt);
+	size_t wildcardCount();
+
+private:
+	enum State { PROBING, NONE, WILDCARD };
+	struct Parent {
+		State state;
+		QueryID probe;
+		std::set<std::string> records; // of the wildcard answer
+		std::vector<QueryID> held;
+	};
+
+	static std::string parentKey(const DNSQuestion &q);
+	static std::string recordKey(const DNSAnswer &a);
+	std::string randomLabel();
+
+	std::mutex mtx;
+	std::unordered_map<std::string, unsigned> counts; // parent -> queries
+	std::unordered_map<std::string, Parent> parents;
+	std::vector<DNSQuestion> probes; // index = id - first_probe
+	std::vector<std::string> probe_parents;
+	std::vector<QueryID> new_probes;
+	const QueryID first_probe;
+	size_t n_wildcards = 0;
+	std::mt19937 rng;
+};
+
+#endif // WILDCARD_HPP
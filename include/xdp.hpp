@@ -0,0 +1,77 @@
+#ifndef XDP_HPP
+#define XDP_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <linux/if_xdp.h>
+
+#include "socket.hpp"
+
+/*
+	https://docs.kernel.org/networking/af_xdp.html
+	Datagrams are sent and received as complete Ethernet frames through an
+	AF_XDP socket in copy mode, bypassing the kernel's UDP stack. A small XDP
+	program steers IPv4 UDP packets to our port into the socket and passes
+	everything else on. IPv4 only, the next hop's MAC address is taken from
+	the kernel's neighbour table.
+	Only one queue of the interface is used, so interfaces with more than one
+	receive queue are refused (use e.g. `ethtool -L <if> combined 1`).
+*/
+
+#define XDP_NUM_FRAMES 4096
+#define XDP_FRAME_SIZE 2048
+#define XDP_RING_SIZE 2048
+
+class XdpSocket : public DatagramSocket {
+public:
+	~XdpSocket();
+
+	// needs CAP_NET_ADMIN and CAP_BPF (or root)
+	bool open(const std::string &ifname, unsigned queue=0);
+	// finds the MAC address packets to addr need to be sent to
+	bool addDestination(const SocketAddress &addr);
+	inline const std::string &getError() const { return error; }
+
+	void sendto(const ustring &data, const SocketAddress &host);
+	void recvfrom(size_t n, ustring *data, struct SocketAddress &source);
+	short poll(short events, int timeout);
+	inline int getLocalPort() { return local_port; }
+	void close();
+
+private:
+	struct Ring {
+		uint32_t *producer, *consumer;
+		void *descs;
+		void *map = nullptr;
+		size_t map_size = 0;
+		uint32_t mask;
+	};
+
+	bool fail(const std::string &what);
+	bool sysFail(const char *call);
+	bool mapRing(Ring &r, const struct xdp_ring_offset &off, uint64_t pgoff, size_t desc_size);
+	bool loadProgram(unsigned queue);
+	void reclaimTx();
+	void kick();
+
+	std::string error;
+	std::string ifname;
+	int ifindex = 0;
+	unsigned char local_mac[6];
+	uint32_t local_ip = 0; // network byte order
+	int local_port = 0;
+	uint16_t ip_id = 0;
+	std::unordered_map<uint32_t, std::vector<unsigned char>> next_hop; // ip -> MAC
+
+	int fd = -1, port_fd = -1, map_fd = -1, prog_fd = -1, link_fd = -1;
+	std::atomic<bool> closed{false};
+	unsigned char *umem = nullptr;
+	Ring fill, comp, rx, tx;
+	// the first half of the frames is for receiving, the second for sending
+	std::vector<uint64_t> free_tx;
+};
+
+#endif // XDP_HPP
@@ -0,0 +1,312 @@
+#include <iostream>
+#include <fstream>
+#include <set>
+#include <unordered_map>
+#include <string.h>
+#include <stdio.h> // rename()
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input.hpp"
+#include "common.hpp"
+#include "socket.hpp"
+#include "dns.hpp"
+#include "query.hpp"
+#include "cache.hpp"
+
+/*
+	Compiled query file (all integers little endian):
+	u32 magic
+	u32 version
+	u64 number of questions (n)
+	u64 number of duplicates (d)
+	u64 offsets[n + 1], where each question starts in the question data
+	duplicates[d]:
+		u64 index, u64 additional times it appeared in the input
+	question data: the questions in wire format, one after the other
+*/
+static const uint32_t COMPILED_MAGIC = 0x4c514844; // "DHQL"
+static const uint32_t COMPILED_VERSION = 1;
+static const size_t COMPILED_HEADER = 24;
+
+static const std::set<char> whitespace{' ', '\t', '\r', '\n'};
+
+static void writeU64(std::ostream &s, uint64_t v)
+{
+	v = htole64(v);
+	s.write((char*) &v, 8);
+}
+
+static void writeU32(std::ostream &s, uint32_t v)
+{
+	v = htole32(v);
+	s.write((char*) &v, 4);
+}
+
+static inline bool is_ip_duplicate(const SocketAddress &search, const std::vector<SocketAddress> &in)
+{
+	for(const auto &addr : in) {
+		if(!memcmp(&addr.addr.sin6_addr.s6_addr, &search.addr.sin6_addr.s6_addr, 16) &&
+			addr.addr.sin6_port == search.addr.sin6_port)
+			return true;
+	}
+	return false;
+}
+
+bool parse_resolver_list(std::istream &s, std::vector<SocketAddress> &res)
+{
+	while(1) {
+		char buf[1024] = {0};
+		bool ok = !!s.getline(buf, sizeof(buf) - 1);
+		if(!ok)
+			break;
+
+		std::string s(buf);
+		trim(s, whitespace);
+
+		if(s.empty() || s[0] == '#')
+			continue; // skip comments and empty lines
+
+		SocketAddress addr;
+		if(!addr.parse(s, 53)) {
+			std::cerr << "\"" << s << "\" is not a valid IP." << std::endl;
+			return false;
+		}
+
+		if(is_ip_duplicate(addr, res)) {
+			std::cerr << "Resolver addresses maybe not be duplicate" << std::endl;
+			return false;
+		}
+
+		res.emplace_back(addr);
+	}
+	return true;
+}
+
+bool parse_query_list(std::istream &s, QueryList &res)
+{
+	// duplicates are collapsed into one query whose answer is written for each
+	std::unordered_map<std::string, size_t> seen;
+	while(1) {
+		char buf[1024] = {0};
+		bool ok = !!s.getline(buf, sizeof(buf) - 1);
+		if(!ok)
+			break;
+
+		std::string s(buf);
+		trim(s, whitespace);
+
+		if(s.empty() || s[0] == '#')
+			continue; // skip comments and empty lines
+
+		struct DNSQuestion q;
+		std::vector<enum DNSType> more_types;
+		try {
+			q.parse(s, &more_types);
+		} catch(DecodeException &e) {
+			std::cerr << "\"" << s << "\" is not a valid DNS question." << std::endl;
+			return false;
+		}
+
+		const bool multi = res.multiType() || !more_types.empty();
+		if(multi && !res.multiType()) {
+			// the lines so far each had one type
+			res.line.reserve(res.questions.size());
+			res.types.reserve(res.questions.size());
+			for(size_t i = 0; i < res.questions.size(); i++) {
+				res.line.push_back(i);
+				res.types.push_back(res.questions[i].qtype);
+			}
+		}
+		if(!multi) {
+			auto it = seen.emplace(AnswerCache::key(q), res.questions.size());
+			if(!it.second) {
+				res.duplicates[it.first->second]++;
+				continue;
+			}
+			res.questions.emplace_back(q);
+			continue;
+		}
+
+		// the types of a line get consecutive ids, so they are sent together
+		more_types.insert(more_types.begin(), q.qtype);
+		bool added = false;
+		for(auto type : more_types) {
+			q.qtype = type;
+			auto it = seen.emplace(AnswerCache::key(q), res.line.size());
+			if(!it.second) {
+				res.duplicates[it.first->second]++;
+				continue;
+			}
+			res.line.push_back(res.questions.size());
+			res.types.push_back(type);
+			added = true;
+		}
+		if(added)
+			res.questions.emplace_back(q);
+	}
+	return true;
+}
+
+bool is_compiled_query_list(const std::string &path)
+{
+	// only regular files can be mapped, reading from a pipe would lose
+	// the start of the input for parse_query_list()
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	std::ifstream f(path, std::ios::binary);
+	uint32_t magic = 0;
+	f.read((char*) &magic, 4);
+	return f.good() && le32toh(magic) == COMPILED_MAGIC;
+}
+
+bool compile_query_list(const QueryList &queries, const std::string &path)
+{
+	uostringstream data;
+	std::vector<uint64_t> offsets;
+	offsets.reserve(queries.size() + 1);
+	for(size_t i = 0; i < queries.size(); i++) {
+		offsets.push_back(data.tellp());
+		queries[i].encode(data);
+	}
+	offsets.push_back(data.tellp());
+
+	// write to a temporary file first, like the checkpoint
+	const std::string tmp = path + ".tmp";
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		writeU32(f, COMPILED_MAGIC);
+		writeU32(f, COMPILED_VERSION);
+		writeU64(f, queries.size());
+		writeU64(f, queries.duplicates.size());
+		for(uint64_t off : offsets)
+			writeU64(f, off);
+		for(auto &it : queries.duplicates) {
+			writeU64(f, it.first);
+			writeU64(f, it.second);
+		}
+		const ustring &buf = data.str();
+		f.write((const char*) buf.data(), buf.size());
+		f.flush();
+		if(!f.good())
+			return false;
+	}
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool map_query_list(const std::string &path, QueryList &res)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd == -1) {
+		std::cerr << "Failed to open file." << std::endl;
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t) COMPILED_HEADER) {
+		close(fd);
+		std::cerr << "Compiled query file is truncated." << std::endl;
+		return false;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		std::cerr << "Failed to map compiled query file." << std::endl;
+		return false;
+	}
+	// stays mapped until the process exits, pages are only read when their
+	// questions are sent
+	const unsigned char *base = (const unsigned char*) p;
+	const size_t size = st.st_size;
+
+	uint32_t magic, version;
+	uint64_t n, d;
+	memcpy(&magic, base, 4);
+	memcpy(&version, base + 4, 4);
+	memcpy(&n, base + 8, 8);
+	memcpy(&d, base + 16, 8);
+	n = le64toh(n);
+	d = le64toh(d);
+	if(le32toh(magic) != COMPILED_MAGIC || le32toh(version) != COMPILED_VERSION) {
+		std::cerr << "Not a compiled query file of this version, compile it again." << std::endl;
+		return false;
+	}
+	if(n >= size / 8 || d >= size / 16 || COMPILED_HEADER + (n + 1) * 8 + d * 16 > size) {
+		std::cerr << "Compiled query file is truncated." << std::endl;
+		return false;
+	}
+	const size_t data_start = COMPILED_HEADER + (n + 1) * 8 + d * 16;
+	res.index = (const uint64_t*) (base + COMPILED_HEADER);
+	res.n_mapped = n;
+	res.data = base + data_start;
+	res.data_size = size - data_start;
+	// decode() trusts the offsets, a question is at least its root label,
+	// type and class
+	uint64_t prev = 0;
+	for(uint64_t i = 0; i <= n; i++) {
+		const uint64_t off = le64toh(res.index[i]);
+		if((i == 0 && off != 0) || (i > 0 && off < prev + 5) || off > res.data_size) {
+			std::cerr << "Compiled query file is corrupt." << std::endl;
+			return false;
+		}
+		prev = off;
+	}
+	if(prev != res.data_size) {
+		std::cerr << "Compiled query file is truncated." << std::endl;
+		return false;
+	}
+
+	const unsigned char *dup = base + COMPILED_HEADER + (n + 1) * 8;
+	for(uint64_t i = 0; i < d; i++) {
+		uint64_t index, extra;
+		memcpy(&index, dup + i * 16, 8);
+		memcpy(&extra, dup + i * 16 + 8, 8);
+		if(le64toh(index) >= n) {
+			std::cerr << "Compiled query file is corrupt." << std::endl;
+			return false;
+		}
+		res.duplicates[le64toh(index)] = le64toh(extra);
+	}
+	return true;
+}
+
+DNSQuestion QueryList::decode(size_t i) const
+{
+	const uint64_t begin = le64toh(index[i]), end = le64toh(index[i + 1]);
+	DECODE_ASSERT(begin < end && end <= data_size);
+	const unsigned char *p = data + begin, *e = data + end;
+
+	DNSQuestion q;
+	while(1) {
+		DECODE_ASSERT(p < e);
+		uint8_t len = *p++;
+		if(len == 0)
+			break;
+		DECODE_ASSERT(len < 64 && len <= e - p);
+		q.name.labels.emplace_back((const char*) p, len);
+		p += len;
+	}
+	DECODE_ASSERT(e - p == 4);
+	q.qtype = (enum DNSType) ((p[0] << 8) | p[1]);
+	q.qclass = (enum DNSClass) ((p[2] << 8) | p[3]);
+	return q;
+}
+
+void trim(std::string &s, const std::set<char> &trimchars)
+{
+	// front
+	size_t i = 0;
+	while(i < s.size() && trimchars.find(s[i]) != trimchars.cend())
+		i++;
+	if(i > 0)
+		s = s.substr(i, s.size() - i);
+
+	// back
+	i = s.size() - 1;
+	while(i >= 0 && trimchars.find(s[i]) != trimchars.cend())
+		i--;
+	s.resize(i + 1);
+}
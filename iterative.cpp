@@ -0,0 +1,341 @@
+#include <ctype.h>
+#include <strings.h> // strcasecmp()
+#include <algorithm>
+
+#include "iterative.hpp"
+#include "backend.hpp"
+#include "socket.hpp"
+#include "dns.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+// https://www.internic.net/domain/named.root (IPv4 only)
+static const char *root_hints[] = {
+	"198.41.0.4", "170.247.170.2", "192.33.4.12", "199.7.91.13",
+	"192.203.230.10", "192.5.5.241", "192.112.36.4", "198.97.190.53",
+	"192.36.148.17", "192.58.128.30", "193.0.14.129", "199.7.83.42",
+	"202.12.27.33",
+};
+
+// lowercase name made of the labels starting at first
+static std::string suffix_key(const DNSName &name, size_t first)
+{
+	if(first >= name.labels.size())
+		return ".";
+	std::string ret;
+	for(size_t i = first; i < name.labels.size(); i++) {
+		for(char c : name.labels[i])
+			ret += tolower(c);
+		ret += '.';
+	}
+	return ret;
+}
+
+static inline std::string name_key(const DNSName &name)
+{
+	return suffix_key(name, 0);
+}
+
+// true if name is zone or below it
+static bool in_zone(const DNSName &name, const DNSName &zone)
+{
+	if(zone.labels.size() > name.labels.size())
+		return false;
+	size_t off = name.labels.size() - zone.labels.size();
+	for(size_t i = 0; i < zone.labels.size(); i++) {
+		if(strcasecmp(name.labels[off + i].c_str(), zone.labels[i].c_str()) != 0)
+			return false;
+	}
+	return true;
+}
+
+template <typename T>
+static inline void push_unique(std::vector<T> &v, const T &x)
+{
+	if(std::find(v.begin(), v.end(), x) == v.end())
+		v.push_back(x);
+}
+
+IterativeResolver::IterativeResolver(QueryBackend &backend) : backend(backend)
+{
+	using namespace std::placeholders;
+	backend.setCallbacks(
+		std::bind(&IterativeResolver::question, this, _1),
+		std::bind(&IterativeResolver::answer, this, _1, _2),
+		std::bind(&IterativeResolver::fail, this, _1));
+	backend.setRouteCallback(std::bind(&IterativeResolver::route, this, _1, _2));
+	backend.setRecursionDesired(false);
+}
+
+void IterativeResolver::addStub(const DNSName &zone, const std::vector<SocketAddress> &servers)
+{
+	MutexAutoLock alock(mtx);
+	size_t z = getZone(zone);
+	for(auto &addr : servers)
+		push_unique(zones[z].servers, getResolver(addr));
+}
+
+void IterativeResolver::addRootHints()
+{
+	std::vector<SocketAddress> servers;
+	for(const char *ip : root_hints) {
+		SocketAddress addr;
+		addr.parse(ip, 53);
+		servers.push_back(addr);
+	}
+	addStub(DNSName(), servers);
+}
+
+void IterativeResolver::setCallbacks(
+	std::function<DNSQuestion(QueryID)> callback_question,
+	std::function<void(const DNSPacket&, QueryID)> callback_answer,
+	std::function<void(QueryID)> callback_fail)
+{
+	this->callback_question = callback_question;
+	this->callback_answer = callback_answer;
+	this->callback_fail = callback_fail;
+}
+
+void IterativeResolver::setLocalCallback(std::function<bool(QueryID)> callback_local)
+{
+	// name server lookups are never answered locally
+	backend.setLocalCallback([callback_local] (QueryID id) -> bool {
+		return id >= 0 && callback_local(id);
+	});
+}
+
+size_t IterativeResolver::zoneCount()
+{
+	MutexAutoLock alock(mtx);
+	return zones.size();
+}
+
+size_t IterativeResolver::lookupCount()
+{
+	MutexAutoLock alock(mtx);
+	return n_lookups;
+}
+
+DNSQuestion IterativeResolver::question(QueryID id)
+{
+	if(id >= 0)
+		return callback_question(id);
+	MutexAutoLock alock(mtx);
+	return lookups.at(id).question;
+}
+
+void IterativeResolver::route(QueryID id, std::vector<size_t> *res)
+{
+	const DNSQuestion q = question(id);
+	MutexAutoLock alock(mtx);
+	size_t z = findZone(q.name);
+	if(z != SIZE_MAX)
+		*res = zones[z].servers;
+}
+
+void IterativeResolver::answer(const DNSPacket &pkt, QueryID id)
+{
+	const DNSQuestion q = question(id);
+	std::vector<QueryID> requeue, failed;
+	bool was_referral;
+	{
+		MutexAutoLock alock(mtx);
+		was_referral = referral(pkt, id, q.name, &requeue, &failed);
+		if(!was_referral)
+			referrals.erase(id);
+	}
+	for(QueryID r : requeue)
+		backend.queue(r);
+	for(QueryID f : failed)
+		fail(f);
+	if(was_referral)
+		return;
+
+	if(id >= 0)
+		callback_answer(pkt, id);
+	else
+		finishLookup(id, &pkt);
+}
+
+void IterativeResolver::fail(QueryID id)
+{
+	if(id >= 0) {
+		{
+			MutexAutoLock alock(mtx);
+			referrals.erase(id);
+		}
+		callback_fail(id);
+	} else {
+		finishLookup(id, nullptr);
+	}
+}
+
+// deepest zone with known servers that contains name
+size_t IterativeResolver::findZone(const DNSName &name)
+{
+	for(size_t i = 0; i <= name.labels.size(); i++) {
+		auto it = zone_index.find(suffix_key(name, i));
+		if(it != zone_index.end() && !zones[it->second].servers.empty())
+			return it->second;
+	}
+	return SIZE_MAX;
+}
+
+size_t IterativeResolver::getZone(const DNSName &name)
+{
+	const std::string key = name_key(name);
+	auto it = zone_index.find(key);
+	if(it != zone_index.end())
+		return it->second;
+	zones.emplace_back();
+	zones.back().name = name;
+	zone_index.emplace(key, zones.size() - 1);
+	return zones.size() - 1;
+}
+
+size_t IterativeResolver::getResolver(const SocketAddress &addr)
+{
+	const ustring key = addr.getIPBytes() + ustring(1, addr.getPort() >> 8) +
+		ustring(1, addr.getPort() & 0xff);
+	auto it = addrs.find(key);
+	if(it != addrs.end())
+		return it->second;
+	size_t rid = backend.addResolver(addr);
+	addrs.emplace(key, rid);
+	return rid;
+}
+
+// handles the answer if it delegates to another zone, returns false otherwise
+bool IterativeResolver::referral(const DNSPacket &pkt, QueryID id, const DNSName &qname,
+	std::vector<QueryID> *requeue, std::vector<QueryID> *failed)
+{
+	if(pkt.rcode() != DNS_RCODE_NOERROR || !pkt.answers.empty() || pkt.authoritative())
+		return false;
+
+	// NS records of the zone cut closest to the name
+	const DNSAnswer *cut = nullptr;
+	std::vector<DNSName> ns;
+	for(auto &a : pkt.authority) {
+		if(a.type != DNS_TYPE_NS || !in_zone(qname, a.name))
+			continue;
+		if(!cut)
+			cut = &a;
+		else if(name_key(a.name) != name_key(cut->name))
+			continue;
+		ns.push_back(a.rdata.name);
+	}
+	if(!cut)
+		return false;
+
+	if(++referrals[id] > ITERATIVE_MAX_REFERRALS) {
+		failed->push_back(id);
+		return true;
+	}
+	size_t z = getZone(cut->name);
+	if(id < 0 && z == lookups.at(id).zone) {
+		// the name server's address is only known inside its own zone
+		failed->push_back(id);
+		return true;
+	}
+
+	Zone &zone = zones[z];
+	if(zone.servers.empty() && !zone.resolving) {
+		// learn the zone cut, using glue records where present
+		zone.unresolved.clear();
+		for(auto &n : ns) {
+			const std::string key = name_key(n);
+			for(auto &a : pkt.additional) {
+				if(a.type != DNS_TYPE_A || name_key(a.name) != key)
+					continue;
+				SocketAddress addr;
+				addr.setIPv4(a.rdata.addr4);
+				addr.setPort(53);
+				push_unique(hosts[key], getResolver(addr));
+			}
+			auto it = hosts.find(key);
+			if(it == hosts.end()) {
+				zone.unresolved.push_back(n);
+				continue;
+			}
+			for(size_t rid : it->second)
+				push_unique(zone.servers, rid);
+		}
+	}
+
+	if(!zone.servers.empty()) {
+		requeue->push_back(id);
+	} else {
+		zone.waiting.push_back(id);
+		if(!zone.resolving)
+			resolveNext(z, id < 0 ? lookups.at(id).depth + 1 : 0, failed);
+	}
+	return true;
+}
+
+// starts looking up the address of the next name server of a zone
+void IterativeResolver::resolveNext(size_t z, unsigned depth, std::vector<QueryID> *failed)
+{
+	Zone &zone = zones[z];
+	if(zone.unresolved.empty() || depth >= ITERATIVE_MAX_DEPTH) {
+		// nothing left to try
+		zone.resolving = false;
+		failed->insert(failed->end(), zone.waiting.begin(), zone.waiting.end());
+		zone.waiting.clear();
+		return;
+	}
+
+	Lookup l;
+	l.question.name = zone.unresolved.back();
+	l.question.qtype = DNS_TYPE_A;
+	l.question.qclass = DNS_CLASS_IN;
+	l.zone = z;
+	l.depth = depth;
+	zone.unresolved.pop_back();
+	zone.resolving = true;
+
+	QueryID id = next_lookup--;
+	lookups.emplace(id, l);
+	n_lookups++;
+	backend.queue(id);
+}
+
+void IterativeResolver::finishLookup(QueryID id, const DNSPacket *pkt)
+{
+	std::vector<QueryID> requeue, failed;
+	{
+		MutexAutoLock alock(mtx);
+		auto it = lookups.find(id);
+		if(it == lookups.end())
+			return;
+		const Lookup l = it->second;
+		lookups.erase(it);
+		referrals.erase(id);
+
+		Zone &zone = zones[l.zone];
+		if(pkt && pkt->rcode() == DNS_RCODE_NOERROR) {
+			const std::string key = name_key(l.question.name);
+			for(auto &a : pkt->answers) {
+				// also accepts the end of a CNAME chain
+				if(a.type != DNS_TYPE_A)
+					continue;
+				SocketAddress addr;
+				addr.setIPv4(a.rdata.addr4);
+				addr.setPort(53);
+				size_t rid = getResolver(addr);
+				push_unique(hosts[key], rid);
+				push_unique(zone.servers, rid);
+			}
+		}
+
+		if(!zone.servers.empty()) {
+			zone.resolving = false;
+			requeue.swap(zone.waiting);
+		} else {
+			resolveNext(l.zone, l.depth, &failed);
+		}
+	}
+	for(QueryID r : requeue)
+		backend.queue(r);
+	for(QueryID f : failed)
+		fail(f);
+}
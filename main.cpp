@@ -1,63 +1,235 @@
 #include <getopt.h>
+#include <unistd.h> // truncate()
+#include <string.h> // strcmp()
 #include <iostream>
 #include <fstream>
-#include <set>
 
 #include "common.hpp"
 #include "socket.hpp"
 #include "dns.hpp"
 #include "query.hpp"
+#include "cache.hpp"
+#include "checkpoint.hpp"
+#include "input.hpp"
+#include "distributed.hpp"
+#include "compress.hpp"
+#include "daemon.hpp"
+#include "walk.hpp"
+#include "trace.hpp"
+#include "chain.hpp"
+#include "filter.hpp"
 
 static void usage();
-static bool parse_resolver_list(std::istream &s, std::vector<SocketAddress> &res);
-static bool parse_query_list(std::istream &s, std::vector<DNSQuestion> &res);
-static void trim(std::string &s, const std::set<char> &trimchars);
+static int compile_main(const char *in, const char *out);
+static std::ostream *open_output(const std::string &path, bool resume, uint64_t offset);
+
+enum {
+	OPT_HEDGE_BUDGET = 256,
+	OPT_HEDGE_TAIL,
+	OPT_RESUME,
+	OPT_STUB_ZONE,
+	OPT_COORDINATOR,
+	OPT_WORKER,
+	OPT_LEASE_SIZE,
+	OPT_LEASE_TIME,
+	OPT_JOB,
+	OPT_DAEMON,
+	OPT_SUBMIT,
+	OPT_WILDCARDS,
+	OPT_NXDOMAIN_CUT,
+	OPT_PARENTS_FIRST,
+	OPT_WALK,
+	OPT_RECORD,
+	OPT_XDP,
+	OPT_AFFINITY,
+	OPT_AFFINITY_SIZE,
+	OPT_TRACE,
+	OPT_STORE,
+	OPT_CHANGES_ONLY,
+	OPT_FOLLOW,
+	OPT_FILTER,
+};
 
 int main(int argc, char *argv[])
 {
 	const struct option long_options[] = {
+		{"affinity", required_argument, 0, OPT_AFFINITY},
+		{"affinity-size", required_argument, 0, OPT_AFFINITY_SIZE},
+		{"backoff", required_argument, 0, 'b'},
+		{"changes-only", no_argument, 0, OPT_CHANGES_ONLY},
 		{"concurrent", required_argument, 0, 'c'},
+		{"consensus", required_argument, 0, 'C'},
+		{"daemon", required_argument, 0, OPT_DAEMON},
+		{"coordinator", required_argument, 0, OPT_COORDINATOR},
+		{"retry-errors", no_argument, 0, 'e'},
+		{"failed-file", required_argument, 0, 'f'},
+		{"filter", required_argument, 0, OPT_FILTER},
+		{"follow", required_argument, 0, OPT_FOLLOW},
 		{"help", no_argument, 0, 'h'},
+		{"hedge", required_argument, 0, 'H'},
+		{"hedge-budget", required_argument, 0, OPT_HEDGE_BUDGET},
+		{"hedge-tail", no_argument, 0, OPT_HEDGE_TAIL},
+		{"iterative", no_argument, 0, 'I'},
+		{"job", required_argument, 0, OPT_JOB},
+		{"lease-size", required_argument, 0, OPT_LEASE_SIZE},
+		{"lease-time", required_argument, 0, OPT_LEASE_TIME},
+		{"checkpoint", required_argument, 0, 'k'},
+		{"metrics", required_argument, 0, 'm'},
+		{"nxdomain-cut", no_argument, 0, OPT_NXDOMAIN_CUT},
 		{"output-file", required_argument, 0, 'o'},
+		{"parents-first", no_argument, 0, OPT_PARENTS_FIRST},
 		{"quiet", no_argument, 0, 'q'},
+		{"record", required_argument, 0, OPT_RECORD},
 		{"resolvers", required_argument, 0, 'r'},
+		{"resume", no_argument, 0, OPT_RESUME},
+		{"retries", required_argument, 0, 'R'},
+		{"store", required_argument, 0, OPT_STORE},
+		{"stub-zone", required_argument, 0, OPT_STUB_ZONE},
+		{"wildcards", required_argument, 0, OPT_WILDCARDS},
+		{"submit", required_argument, 0, OPT_SUBMIT},
+		{"walk", no_argument, 0, OPT_WALK},
+		{"worker", required_argument, 0, OPT_WORKER},
+#ifdef WITH_XDP
+		{"xdp", required_argument, 0, OPT_XDP},
+#endif
+#ifdef WITH_TRACE
+		{"trace", required_argument, 0, OPT_TRACE},
+#endif
 		{0,0,0,0},
 	};
 
+	if(argc > 1 && !strcmp(argv[1], "compile")) {
+		if(argc != 4) {
+			usage();
+			return 1;
+		}
+		return compile_main(argv[2], argv[3]);
+	}
+
 	std::ostream *outfile = &std::cout;
 	std::vector<SocketAddress> resolvers;
-	bool quiet = false;
-	unsigned concurrent = 2;
-	std::vector<DNSQuestion> queries;
+	QueryOptions opts;
+	QueryList queries;
+	std::string outfile_path, failfile_path;
+	bool resume = false;
+	SocketAddress coordinator, worker;
+	bool is_coordinator = false, is_worker = false;
+	std::vector<std::string> job_args;
+	std::string daemon_path, submit_path;
+	bool walk = false;
+	std::vector<DNSName> walk_start;
 
 	while(1) {
-		int c = getopt_long(argc, argv, "c:ho:qr:", long_options, NULL);
+		int c = getopt_long(argc, argv, "b:c:C:ef:hH:Ik:m:o:qr:R:", long_options, NULL);
 		if(c == -1)
 			break;
 		switch(c) {
+			case 'b': {
+				std::istringstream iss(optarg);
+				int backoff = -1;
+				iss >> backoff;
+
+				if(backoff < 0) {
+					std::cerr << "Invalid value for --backoff." << std::endl;
+					return 1;
+				}
+				opts.backoff = backoff;
+				break;
+			}
 			case 'c': {
 				std::istringstream iss(optarg);
-				concurrent = -1;
-				iss >> concurrent;
+				opts.concurrent = -1;
+				iss >> opts.concurrent;
 
-				if(concurrent < 1) {
+				if(opts.concurrent < 1) {
 					std::cerr << "Invalid value for --concurrent." << std::endl;
 					return 1;
 				}
 				break;
 			}
+			case 'C': {
+				std::istringstream iss(optarg);
+				opts.consensus = 0;
+				iss >> opts.consensus;
+
+				if(opts.consensus < 1) {
+					std::cerr << "Invalid value for --consensus." << std::endl;
+					return 1;
+				}
+				break;
+			}
+			case 'e':
+				opts.retry_errors = true;
+				break;
+			case 'f':
+				failfile_path = optarg;
+				break;
 			case 'h':
 				usage();
 				return 1;
-			case 'o':
-				outfile = new std::ofstream(optarg);
-				if(!outfile->good()) {
-					std::cerr << "Failed to open output file." << std::endl;
+			case 'H': {
+				std::istringstream iss(optarg);
+				opts.hedge_percentile = -1;
+				iss >> opts.hedge_percentile;
+
+				if(opts.hedge_percentile <= 0 || opts.hedge_percentile >= 100) {
+					std::cerr << "Invalid value for --hedge." << std::endl;
 					return 1;
 				}
 				break;
+			}
+			case OPT_HEDGE_BUDGET: {
+				std::istringstream iss(optarg);
+				opts.hedge_budget = -1;
+				iss >> opts.hedge_budget;
+
+				if(opts.hedge_budget < 0) {
+					std::cerr << "Invalid value for --hedge-budget." << std::endl;
+					return 1;
+				}
+				break;
+			}
+			case OPT_HEDGE_TAIL:
+				opts.hedge_tail = true;
+				break;
+			case OPT_AFFINITY: {
+				std::istringstream iss(optarg);
+				int labels = -1;
+				iss >> labels;
+
+				if(labels < 1 || labels > 127) {
+					std::cerr << "Invalid value for --affinity." << std::endl;
+					return 1;
+				}
+				opts.affinity_labels = labels;
+				break;
+			}
+			case OPT_AFFINITY_SIZE: {
+				std::istringstream iss(optarg);
+				int n = -1;
+				iss >> n;
+
+				if(n < 1) {
+					std::cerr << "Invalid value for --affinity-size." << std::endl;
+					return 1;
+				}
+				opts.affinity_resolvers = n;
+				break;
+			}
+			case 'I':
+				opts.iterative = true;
+				break;
+			case 'k':
+				opts.checkpoint_file = optarg;
+				break;
+			case 'm':
+				opts.metrics_target = optarg;
+				break;
+			case 'o':
+				outfile_path = optarg;
+				break;
 			case 'q':
-				quiet = true;
+				opts.quiet = true;
 				break;
 			case 'r': {
 				std::ifstream f(optarg);
@@ -69,16 +241,217 @@ int main(int argc, char *argv[])
 					return 1;
 				break;
 			}
+			case OPT_RESUME:
+				resume = true;
+				break;
+			case 'R': {
+				std::istringstream iss(optarg);
+				int retries = -1;
+				iss >> retries;
+
+				if(retries < 0) {
+					std::cerr << "Invalid value for --retries." << std::endl;
+					return 1;
+				}
+				opts.max_retries = retries;
+				break;
+			}
+			case OPT_STUB_ZONE:
+				opts.stub_zone = optarg;
+				break;
+			case OPT_COORDINATOR:
+				if(!coordinator.parse(optarg, 0)) {
+					std::cerr << "Invalid value for --coordinator." << std::endl;
+					return 1;
+				}
+				is_coordinator = true;
+				break;
+			case OPT_WORKER:
+				if(!worker.parse(optarg, 0)) {
+					std::cerr << "Invalid value for --worker." << std::endl;
+					return 1;
+				}
+				is_worker = true;
+				break;
+			case OPT_LEASE_SIZE: {
+				std::istringstream iss(optarg);
+				int size = -1;
+				iss >> size;
+
+				if(size < 1) {
+					std::cerr << "Invalid value for --lease-size." << std::endl;
+					return 1;
+				}
+				opts.lease_size = size;
+				break;
+			}
+			case OPT_LEASE_TIME: {
+				std::istringstream iss(optarg);
+				int time = -1;
+				iss >> time;
+
+				if(time < 1) {
+					std::cerr << "Invalid value for --lease-time." << std::endl;
+					return 1;
+				}
+				opts.lease_time = time;
+				break;
+			}
+			case OPT_JOB:
+				job_args.push_back(optarg);
+				break;
+			case OPT_DAEMON:
+				daemon_path = optarg;
+				break;
+			case OPT_SUBMIT:
+				submit_path = optarg;
+				break;
+			case OPT_NXDOMAIN_CUT:
+				opts.nxdomain_cut = true;
+				break;
+			case OPT_PARENTS_FIRST:
+				opts.parents_first = true;
+				break;
+			case OPT_WALK:
+				walk = true;
+				break;
+			case OPT_RECORD:
+				opts.record_file = optarg;
+				break;
+			case OPT_XDP:
+				opts.xdp_interface = optarg;
+				break;
+			case OPT_STORE:
+				opts.store_file = optarg;
+				break;
+			case OPT_CHANGES_ONLY:
+				opts.changes_only = true;
+				break;
+			case OPT_FOLLOW:
+				if(!ChainFollower::parseRules(optarg, &opts.follow)) {
+					std::cerr << "Invalid value for --follow." << std::endl;
+					return 1;
+				}
+				break;
+			case OPT_FILTER:
+				if(!opts.filter)
+					opts.filter = new AnswerFilter();
+				if(!opts.filter->add(optarg)) {
+					std::cerr << "Invalid value for --filter." << std::endl;
+					return 1;
+				}
+				break;
+#ifdef WITH_TRACE
+			case OPT_TRACE:
+				trace_dump_at_exit(optarg);
+				break;
+#endif
+			case OPT_WILDCARDS:
+				if(!strcmp(optarg, "skip")) {
+					opts.wildcards = WILDCARDS_SKIP;
+				} else if(!strcmp(optarg, "filter")) {
+					opts.wildcards = WILDCARDS_FILTER;
+				} else {
+					std::cerr << "Invalid value for --wildcards." << std::endl;
+					return 1;
+				}
+				break;
 			default:
 				break;
 		}
 	}
 
-	if(argc - optind != 1) {
+	if(!opts.xdp_interface.empty() && (opts.iterative || is_coordinator || is_worker ||
+		!daemon_path.empty() || !submit_path.empty() || walk)) {
+		std::cerr << "--xdp can not be combined with --iterative, --coordinator, --worker, "
+			"--daemon, --submit or --walk." << std::endl;
+		return 1;
+	}
+
+	if(!opts.store_file.empty() && (is_coordinator || is_worker || !daemon_path.empty() ||
+		!submit_path.empty() || walk || !opts.checkpoint_file.empty())) {
+		std::cerr << "--store can not be combined with --coordinator, --worker, --daemon, "
+			"--submit, --walk or --checkpoint." << std::endl;
+		return 1;
+	}
+	if(opts.follow && (is_coordinator || is_worker || !daemon_path.empty() ||
+		!submit_path.empty() || walk || !opts.store_file.empty())) {
+		std::cerr << "--follow can not be combined with --coordinator, --worker, --daemon, "
+			"--submit, --walk or --store." << std::endl;
+		return 1;
+	}
+	if(opts.filter && (is_coordinator || !daemon_path.empty() || !submit_path.empty() ||
+		!opts.store_file.empty())) {
+		std::cerr << "--filter can not be combined with --coordinator, --daemon, --submit or --store." << std::endl;
+		return 1;
+	}
+	if(opts.changes_only && opts.store_file.empty()) {
+		std::cerr << "--changes-only requires --store." << std::endl;
+		return 1;
+	}
+
+	if(is_worker) {
+		// the queries come from the coordinator
+		if(argc - optind != 0 || is_coordinator) {
+			usage();
+			return 1;
+		}
+		if(resolvers.empty()) {
+			std::cerr << "At least one resolver is required." << std::endl;
+			return 1;
+		}
+		if(opts.iterative || opts.consensus > 1 || opts.wildcards != WILDCARDS_OFF) {
+			std::cerr << "--worker can not be combined with --iterative, --consensus or --wildcards." << std::endl;
+			return 1;
+		}
+		return worker_main(opts, worker, resolvers);
+	}
+	if(!daemon_path.empty()) {
+		// the queries come from clients
+		if(argc - optind != 0 || is_coordinator || !submit_path.empty() || !job_args.empty()) {
+			usage();
+			return 1;
+		}
+		if(resolvers.empty()) {
+			std::cerr << "At least one resolver is required." << std::endl;
+			return 1;
+		}
+		if(opts.iterative || opts.consensus > 1 || opts.wildcards != WILDCARDS_OFF) {
+			std::cerr << "--daemon can not be combined with --iterative, --consensus or --wildcards." << std::endl;
+			return 1;
+		}
+		return daemon_main(opts, daemon_path, resolvers);
+	}
+	if(argc - optind != (job_args.empty() ? 1 : 0)) {
 		usage();
 		return 1;
 	}
-	{
+	if(walk) {
+		std::ifstream f(argv[optind]);
+		if(!f.good()) {
+			std::cerr << "Failed to open file." << std::endl;
+			return 1;
+		}
+		if(!parse_walk_list(f, walk_start))
+			return 1;
+		if(walk_start.empty()) {
+			std::cerr << "At least one prefix is required." << std::endl;
+			return 1;
+		}
+		if(resolvers.empty()) {
+			std::cerr << "At least one resolver is required." << std::endl;
+			return 1;
+		}
+		if(opts.iterative || opts.consensus > 1 || opts.wildcards != WILDCARDS_OFF || is_coordinator ||
+			!submit_path.empty() || !job_args.empty() || !opts.checkpoint_file.empty()) {
+			std::cerr << "--walk can not be combined with --iterative, --consensus, --wildcards, "
+				"--coordinator, --submit, --job or --checkpoint." << std::endl;
+			return 1;
+		}
+	} else if(job_args.empty() && is_compiled_query_list(argv[optind])) {
+		if(!map_query_list(argv[optind], queries))
+			return 1;
+	} else if(job_args.empty()) {
 		std::ifstream f(argv[optind]);
 		if(!f.good()) {
 			std::cerr << "Failed to open file." << std::endl;
@@ -87,21 +460,155 @@ int main(int argc, char *argv[])
 		if(!parse_query_list(f, queries))
 			return 1;
 	}
+	for(auto &arg : job_args) {
+		// <weight>:<query file>:<output file>
+		size_t pos1 = arg.find(':'), pos2 = arg.find(':', pos1 + 1);
+		QueryJob job;
+		int weight = -1;
+		if(pos2 != std::string::npos) {
+			std::istringstream iss(arg.substr(0, pos1));
+			iss >> weight;
+		}
+		if(weight < 1 || pos2 == pos1 + 1 || pos2 + 1 == arg.size()) {
+			std::cerr << "Invalid value for --job." << std::endl;
+			return 1;
+		}
+		job.name = arg.substr(pos1 + 1, pos2 - pos1 - 1);
+		job.weight = weight;
+
+		if(is_compiled_query_list(job.name)) {
+			std::cerr << "--job can not be used with compiled query files." << std::endl;
+			return 1;
+		}
+		std::ifstream f(job.name);
+		if(!f.good()) {
+			std::cerr << "Failed to open file." << std::endl;
+			return 1;
+		}
+		// duplicates are only merged within a job, each has its own output
+		job.first = queries.size();
+		if(!parse_query_list(f, queries))
+			return 1;
+		job.count = queries.size() - job.first;
+		if(job.count == 0) {
+			std::cerr << "Job " << job.name << " has no queries." << std::endl;
+			return 1;
+		}
+
+		job.outfile = open_output(arg.substr(pos2 + 1), false, 0);
+		if(!job.outfile) {
+			std::cerr << "Failed to open output file." << std::endl;
+			return 1;
+		}
+		opts.jobs.push_back(job);
+	}
+	if(!opts.jobs.empty() && (!outfile_path.empty() || !opts.checkpoint_file.empty()
+		|| opts.iterative || is_coordinator)) {
+		std::cerr << "--job can not be combined with --output-file, --checkpoint, --iterative or --coordinator." << std::endl;
+		return 1;
+	}
 
-	if(queries.empty()) {
+	if(queries.empty() && !walk) {
 		std::cerr << "At least one query is required." << std::endl;
 		return 1;
 	}
-	if(resolvers.empty()) {
+	if(resolvers.empty() && !opts.iterative && !is_coordinator && submit_path.empty()) {
 		std::cerr << "At least one resolver is required." << std::endl;
 		return 1;
 	}
+	if(opts.iterative) {
+		// resolvers are optional, they're the servers of the stub zone
+		if(opts.stub_zone.empty()) {
+			opts.stub_zone = ".";
+		} else if(resolvers.empty()) {
+			std::cerr << "--stub-zone requires a list of resolvers." << std::endl;
+			return 1;
+		}
+		if(opts.stub_zone.back() != '.') {
+			std::cerr << "Invalid value for --stub-zone." << std::endl;
+			return 1;
+		}
+		if(opts.consensus > 1 || opts.hedge_percentile > 0) {
+			std::cerr << "--iterative can not be combined with --consensus or --hedge." << std::endl;
+			return 1;
+		}
+	} else if(!opts.stub_zone.empty()) {
+		std::cerr << "--stub-zone requires --iterative." << std::endl;
+		return 1;
+	}
+
+	if(opts.consensus > 1 && opts.consensus > resolvers.size()) {
+		std::cerr << "--consensus needs at least as many resolvers." << std::endl;
+		return 1;
+	}
+	if(opts.consensus > 1 && opts.hedge_percentile > 0) {
+		std::cerr << "--consensus and --hedge can not be combined." << std::endl;
+		return 1;
+	}
+
+	if(!submit_path.empty() && (is_coordinator || !opts.jobs.empty() || !opts.checkpoint_file.empty())) {
+		std::cerr << "--submit can not be combined with --coordinator, --job or --checkpoint." << std::endl;
+		return 1;
+	}
+	if(opts.wildcards != WILDCARDS_OFF && (is_coordinator || !submit_path.empty())) {
+		std::cerr << "--wildcards can not be combined with --coordinator or --submit." << std::endl;
+		return 1;
+	}
+	if(is_coordinator && !opts.checkpoint_file.empty()) {
+		std::cerr << "--coordinator can not be combined with --checkpoint." << std::endl;
+		return 1;
+	}
+
+	uint64_t out_offset = 0, fail_offset = 0;
+	if(!opts.checkpoint_file.empty()) {
+		if(outfile_path.empty()) {
+			std::cerr << "--checkpoint requires an output file." << std::endl;
+			return 1;
+		}
+		opts.checkpoint = new Checkpoint(queries.size());
+		opts.outfile_path = outfile_path;
+		opts.failfile_path = failfile_path;
+		if(resume && !opts.checkpoint->load(opts.checkpoint_file, &out_offset, &fail_offset))
+			return 1;
+	} else if(resume) {
+		std::cerr << "--resume requires --checkpoint." << std::endl;
+		return 1;
+	}
+
+	if(!outfile_path.empty()) {
+		outfile = open_output(outfile_path, resume, out_offset);
+		if(!outfile) {
+			std::cerr << "Failed to open output file." << std::endl;
+			return 1;
+		}
+	}
+	if(!failfile_path.empty()) {
+		opts.failfile = open_output(failfile_path, resume, fail_offset);
+		if(!opts.failfile) {
+			std::cerr << "Failed to open failed queries file." << std::endl;
+			return 1;
+		}
+	}
 
 	resolvers.shrink_to_fit();
-	queries.shrink_to_fit();
+	queries.questions.shrink_to_fit();
+	queries.line.shrink_to_fit();
+	queries.types.shrink_to_fit();
 
-	int ret = query_main(*outfile, quiet, concurrent, resolvers, queries);
+	int ret;
+	if(walk)
+		ret = walk_main(*outfile, opts, resolvers, walk_start);
+	else if(is_coordinator)
+		ret = coordinator_main(*outfile, opts, coordinator, queries);
+	else if(!submit_path.empty())
+		ret = submit_main(*outfile, opts, submit_path, queries);
+	else
+		ret = query_main(*outfile, opts, resolvers, queries);
 	outfile->flush();
+	for(auto &job : opts.jobs)
+		job.outfile->flush();
+	if(opts.failfile)
+		opts.failfile->flush();
 
 	return ret;
 }
@@ -111,96 +618,104 @@ static void usage(void)
 	std::cout
 		<< "DNSHammer completes lots of DNS queries asynchronously" << std::endl
 		<< "Usage: dnshammer [options] <file with queries>" << std::endl
+		<< "       dnshammer [options] --job <weight>:<query file>:<output file> [--job ...]" << std::endl
+		<< "       dnshammer [options] --walk <file with ip6.arpa names or IPv6 prefixes>" << std::endl
+		<< "       dnshammer [options] --worker <ip:port>" << std::endl
+		<< "       dnshammer [options] --daemon <path>" << std::endl
+		<< "       dnshammer compile <file with queries> <compiled file>" << std::endl
 		<< "Options:" << std::endl
 		<< "  -h|--help               This text" << std::endl
 		<< "  -r|--resolvers <file>   List of resolvers to query" << std::endl
-		<< "  -o|--output-file <file> Output file (defaults to standard output)" << std::endl
+		<< "  -o|--output-file <file> Output file (defaults to standard output), gzip compressed if it ends in .gz" << std::endl
 		<< "  -c|--concurrent <n>     Number of concurrent requests per resolver (defaults to 2)" << std::endl
 		<< "  -q|--quiet              Disable periodic status message" << std::endl
+		<< "  -m|--metrics <target>   Export metrics every second to a file (JSON if it ends in .json," << std::endl
+		<< "                          Prometheus text otherwise) or a unix socket (unix:<path>)" << std::endl
+		<< "  -R|--retries <n>        Give up on a query after retrying it n times (defaults to 10)" << std::endl
+		<< "  -b|--backoff <sec>      Wait sec * attempts seconds before retrying a query" << std::endl
+		<< "  -e|--retry-errors       Retry SERVFAIL and REFUSED answers with a different resolver" << std::endl
+		<< "  -f|--failed-file <file> Write queries that failed permanently to this file" << std::endl
+		<< "  -k|--checkpoint <file>  Periodically save progress to this file" << std::endl
+		<< "  --resume                Continue from the progress saved by --checkpoint" << std::endl
+		<< "  -C|--consensus <k>      Send every query to k resolvers and only accept the majority answer" << std::endl
+		<< "  -H|--hedge <pct>        Duplicate queries slower than the pct-th latency percentile to another resolver" << std::endl
+		<< "  --hedge-budget <pct>    Limit duplicated queries to pct percent of all queries (defaults to 5)" << std::endl
+		<< "  --hedge-tail            Only start hedging once all queries were sent once" << std::endl
+		<< "  --affinity <labels>     Send queries whose names end in the same labels to the same few resolvers" << std::endl
+		<< "  --affinity-size <n>     Number of resolvers every group of --affinity is sent to (defaults to 2)" << std::endl
+		<< "  -I|--iterative          Query authoritative servers directly, starting at the root" << std::endl
+		<< "  --stub-zone <zone>      With -I: start at this zone, the resolvers (-r) are its servers" << std::endl
+		<< "  --job <w>:<in>:<out>    Run the queries from file in alongside other jobs, with a share of the" << std::endl
+		<< "                          sends proportional to w, writing the answers to file out" << std::endl
+		<< "  --wildcards <mode>      Probe parents of the queried names for wildcard records, then skip the" << std::endl
+		<< "                          queries below them (skip) or drop answers from the wildcard (filter)" << std::endl
+		<< "  --nxdomain-cut          Don't send queries below names that got NXDOMAIN (RFC 8020)" << std::endl
+		<< "  --parents-first         Send the queries for names with fewer labels first" << std::endl
+		<< "  --follow <rules>        Send follow-up queries for answers, rules: cname,ns,mx,ptr,aaaa" << std::endl
+		<< "  --filter <expr>         Only write records matching expr, e.g. type=A|AAAA, data~*.example. or" << std::endl
+		<< "                          name!=@ (can be given multiple times, all have to match)" << std::endl
+		<< "  --walk                  Find all PTR records below the given ip6.arpa names by walking the tree" << std::endl
+		<< "  --record <file>         Write all sent and received packets to a pcap file" << std::endl
+		<< "  --store <file>          Keep answers in file and only send the queries whose answers expired" << std::endl
+		<< "  --changes-only          Only write answers that differ from the ones in the --store" << std::endl
+#ifdef WITH_XDP
+		<< "  --xdp <interface>       Send and receive through an AF_XDP socket on interface (IPv4 only)" << std::endl
+#endif
+#ifdef WITH_TRACE
+		<< "  --trace <file>          Write the spans of the last queries as Chrome trace JSON on exit" << std::endl
+#endif
+		<< "  --coordinator <ip:port> Hand out the queries to workers connecting to this address" << std::endl
+		<< "  --lease-size <n>        Number of queries handed out at once (defaults to 1000)" << std::endl
+		<< "  --lease-time <sec>      Give a lease to another worker after sec seconds (defaults to 300)" << std::endl
+		<< "  --worker <ip:port>      Resolve queries for the coordinator at this address (no query file)" << std::endl
+		<< "  --daemon <path>         Keep running and resolve queries submitted to the unix socket at path" << std::endl
+		<< "  --submit <path>         Have the daemon at path resolve the queries instead (no -r needed)" << std::endl
 	;
 }
 
-static const std::set<char> whitespace{' ', '\t', '\r', '\n'};
-
-static inline bool is_ip_duplicate(const SocketAddress &search, const std::vector<SocketAddress> &in)
+static int compile_main(const char *in, const char *out)
 {
-	for(const auto &addr : in) {
-		if(!memcmp(&addr.addr.sin6_addr.s6_addr, &search.addr.sin6_addr.s6_addr, 16))
-			return true;
+	std::ifstream f(in);
+	if(!f.good()) {
+		std::cerr << "Failed to open file." << std::endl;
+		return 1;
 	}
-	return false;
-}
-
-static bool parse_resolver_list(std::istream &s, std::vector<SocketAddress> &res)
-{
-	while(1) {
-		char buf[1024] = {0};
-		bool ok = !!s.getline(buf, sizeof(buf) - 1);
-		if(!ok)
-			break;
-
-		std::string s(buf);
-		trim(s, whitespace);
-
-		if(s.empty() || s[0] == '#')
-			continue; // skip comments and empty lines
-
-		SocketAddress addr;
-		if(!addr.parseIP(s)) {
-			std::cerr << "\"" << s << "\" is not a valid IP." << std::endl;
-			return false;
-		}
-		addr.setPort(53); // TODO: make this configurable?
-
-		if(is_ip_duplicate(addr, res)) {
-			std::cerr << "Resolver addresses maybe not be duplicate" << std::endl;
-			return false;
-		}
-
-		res.emplace_back(addr);
+	QueryList queries;
+	if(!parse_query_list(f, queries))
+		return 1;
+	if(!compile_query_list(queries, out)) {
+		std::cerr << "Failed to write compiled query file." << std::endl;
+		return 1;
 	}
-	return true;
+	std::cerr << "Compiled " << queries.size() << " queries." << std::endl;
+	return 0;
 }
 
-static bool parse_query_list(std::istream &s, std::vector<struct DNSQuestion> &res)
+static std::ostream *open_output(const std::string &path, bool resume, uint64_t offset)
 {
-	while(1) {
-		char buf[1024] = {0};
-		bool ok = !!s.getline(buf, sizeof(buf) - 1);
-		if(!ok)
-			break;
-
-		std::string s(buf);
-		trim(s, whitespace);
+	// drop whatever was written after the checkpoint
+	if(resume && truncate(path.c_str(), offset) != 0)
+		return nullptr;
 
-		if(s.empty() || s[0] == '#')
-			continue; // skip comments and empty lines
-
-		struct DNSQuestion q;
-		try {
-			q.parse(s);
-		} catch(DecodeException &e) {
-			std::cerr << "\"" << s << "\" is not a valid DNS question." << std::endl;
-			return false;
+	if(is_gzip_path(path)) {
+		GzipStreamBuf *buf = new GzipStreamBuf();
+		if(!buf->open(path, resume)) {
+			delete buf;
+			return nullptr;
 		}
-
-		res.emplace_back(q);
+		return new std::ostream(buf);
 	}
-	return true;
-}
 
-static void trim(std::string &s, const std::set<char> &trimchars)
-{
-	// front
-	size_t i = 0;
-	while(i < s.size() && trimchars.find(s[i]) != trimchars.cend())
-		i++;
-	if(i > 0)
-		s = s.substr(i, s.size() - i);
-
-	// back
-	i = s.size() - 1;
-	while(i >= 0 && trimchars.find(s[i]) != trimchars.cend())
-		i--;
-	s.resize(i + 1);
+	std::ofstream *f;
+	if(resume) {
+		f = new std::ofstream(path, std::ios::app);
+		f->seekp(0, std::ios::end); // so that tellp() reports the right offset
+	} else {
+		f = new std::ofstream(path);
+	}
+	if(!f->good()) {
+		delete f;
+		return nullptr;
+	}
+	return f;
 }
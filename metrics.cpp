@@ -0,0 +1,223 @@
+#include <stdio.h> // rename()
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "metrics.hpp"
+
+static const char *rcode_names[16] = {
+	"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED", "YXDOMAIN", "YXRRSET",
+	"NXRRSET", "NOTAUTH", "NOTZONE", "RCODE11", "RCODE12", "RCODE13", "RCODE14", "RCODE15",
+};
+
+static const float percentiles[] = { 50, 90, 99, 99.9 };
+
+std::string metrics_json(const Metrics &m, const std::vector<ResolverStats> &res)
+{
+	std::ostringstream oss;
+	oss << "{\"sent\":" << m.sent.get()
+		<< ",\"received\":" << m.received.get()
+		<< ",\"timeouts\":" << m.timeouts.get()
+		<< ",\"retries\":" << m.retries.get()
+		<< ",\"failed\":" << m.failed.get()
+		<< ",\"hedged\":" << m.hedged.get()
+		<< ",\"local\":" << m.local.get()
+		<< ",\"late\":" << m.late.get()
+		<< ",\"decode_errors\":" << m.decode_errors.get()
+		<< ",\"spilled\":" << m.spilled.get()
+		<< ",\"degraded\":" << m.degraded.get()
+		<< ",\"lock_wait_us\":" << m.lock_wait_us.get();
+
+	oss << ",\"rcodes\":{";
+	bool first = true;
+	for(int i = 0; i < 16; i++) {
+		if(m.rcodes[i].get() == 0)
+			continue;
+		oss << (first ? "" : ",") << "\"" << rcode_names[i] << "\":" << m.rcodes[i].get();
+		first = false;
+	}
+	oss << "}";
+
+	oss << ",\"rtt_us\":{\"count\":" << m.rtt.count() << ",\"sum\":" << m.rtt.sum();
+	for(float p : percentiles)
+		oss << ",\"p" << p << "\":" << m.rtt.percentile(p);
+	oss << "}";
+
+	oss << ",\"resolvers\":[";
+	for(size_t i = 0; i < res.size(); i++) {
+		const ResolverStats &r = res[i];
+		oss << (i == 0 ? "" : ",")
+			<< "{\"addr\":\"" << r.addr << "\""
+			<< ",\"sent\":" << r.sent
+			<< ",\"received\":" << r.received
+			<< ",\"timeouts\":" << r.timeouts
+			<< ",\"errors\":" << r.errors
+			<< ",\"rtt_sum_us\":" << r.rtt_sum_us
+			<< ",\"capacity\":" << r.capacity << "}";
+	}
+	oss << "]}\n";
+	return oss.str();
+}
+
+std::string metrics_prometheus(const Metrics &m, const std::vector<ResolverStats> &res)
+{
+	std::ostringstream oss;
+	auto counter = [&] (const char *name, uint64_t v) {
+		oss << "# TYPE dnshammer_" << name << " counter\n"
+			<< "dnshammer_" << name << " " << v << "\n";
+	};
+	counter("queries_sent_total", m.sent.get());
+	counter("answers_received_total", m.received.get());
+	counter("timeouts_total", m.timeouts.get());
+	counter("retries_total", m.retries.get());
+	counter("queries_failed_total", m.failed.get());
+	counter("queries_hedged_total", m.hedged.get());
+	counter("queries_local_total", m.local.get());
+	counter("late_answers_total", m.late.get());
+	counter("decode_errors_total", m.decode_errors.get());
+	counter("queries_spilled_total", m.spilled.get());
+	counter("queries_degraded_total", m.degraded.get());
+	counter("lock_wait_microseconds_total", m.lock_wait_us.get());
+
+	oss << "# TYPE dnshammer_answers_by_rcode_total counter\n";
+	for(int i = 0; i < 16; i++) {
+		if(m.rcodes[i].get() == 0)
+			continue;
+		oss << "dnshammer_answers_by_rcode_total{rcode=\"" << rcode_names[i] << "\"} "
+			<< m.rcodes[i].get() << "\n";
+	}
+
+	oss << "# TYPE dnshammer_rtt_seconds histogram\n";
+	uint64_t cumulative = 0;
+	for(int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+		uint64_t n = m.rtt.bucketCount(i);
+		if(n == 0)
+			continue;
+		cumulative += n;
+		oss << "dnshammer_rtt_seconds_bucket{le=\"" << (LatencyHistogram::upperBound(i) / 1e6)
+			<< "\"} " << cumulative << "\n";
+	}
+	oss << "dnshammer_rtt_seconds_bucket{le=\"+Inf\"} " << m.rtt.count() << "\n"
+		<< "dnshammer_rtt_seconds_sum " << (m.rtt.sum() / 1e6) << "\n"
+		<< "dnshammer_rtt_seconds_count " << m.rtt.count() << "\n";
+
+	auto per_resolver = [&] (const char *name, const char *type, uint64_t ResolverStats::*field) {
+		oss << "# TYPE dnshammer_resolver_" << name << " " << type << "\n";
+		for(auto &r : res) {
+			oss << "dnshammer_resolver_" << name << "{resolver=\"" << r.addr << "\"} "
+				<< r.*field << "\n";
+		}
+	};
+	per_resolver("sent_total", "counter", &ResolverStats::sent);
+	per_resolver("received_total", "counter", &ResolverStats::received);
+	per_resolver("timeouts_total", "counter", &ResolverStats::timeouts);
+	per_resolver("errors_total", "counter", &ResolverStats::errors);
+	per_resolver("rtt_microseconds_sum", "counter", &ResolverStats::rtt_sum_us);
+	oss << "# TYPE dnshammer_resolver_capacity gauge\n";
+	for(auto &r : res)
+		oss << "dnshammer_resolver_capacity{resolver=\"" << r.addr << "\"} " << r.capacity << "\n";
+	return oss.str();
+}
+
+std::string metrics_summary(const Metrics &m, const std::vector<ResolverStats> &res)
+{
+	std::ostringstream oss;
+	oss << "Queries sent: " << m.sent.get() << ", answers: " << m.received.get()
+		<< ", timeouts: " << m.timeouts.get() << ", retries: " << m.retries.get()
+		<< ", failed: " << m.failed.get() << "\n";
+	if(m.hedged.get() > 0 || m.local.get() > 0)
+		oss << "Hedged: " << m.hedged.get() << ", answered locally: " << m.local.get() << "\n";
+	if(m.late.get() > 0 || m.decode_errors.get() > 0)
+		oss << "Late answers: " << m.late.get() << ", undecodable: " << m.decode_errors.get() << "\n";
+	if(m.spilled.get() > 0)
+		oss << "Queries not sent to their zone's resolvers: " << m.spilled.get() << "\n";
+	if(m.degraded.get() > 0)
+		oss << "Queries sent to fewer resolvers than --consensus asks for: " << m.degraded.get() << "\n";
+
+	oss << "Answers by rcode:";
+	for(int i = 0; i < 16; i++) {
+		if(m.rcodes[i].get() > 0)
+			oss << " " << rcode_names[i] << "=" << m.rcodes[i].get();
+	}
+	oss << "\n";
+
+	oss << "Round trip time (ms):";
+	for(float p : percentiles)
+		oss << " p" << p << "=" << (m.rtt.percentile(p) / 1000.f);
+	oss << "\n";
+
+	unsigned dead = 0;
+	for(auto &r : res)
+		dead += r.capacity == 0 ? 1 : 0;
+	oss << "Resolvers without capacity left: " << dead << " of " << res.size() << "\n";
+	return oss.str();
+}
+
+
+MetricsExporter::~MetricsExporter()
+{
+	if(listen_fd != -1) {
+		::close(listen_fd);
+		unlink(path.c_str());
+	}
+}
+
+bool MetricsExporter::open(const std::string &target)
+{
+	if(target.compare(0, 5, "unix:") == 0) {
+		path = target.substr(5);
+		struct sockaddr_un addr = { 0 };
+		addr.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(addr.sun_path))
+			return false;
+		memcpy(addr.sun_path, path.c_str(), path.size());
+
+		listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if(listen_fd == -1)
+			return false;
+		unlink(path.c_str());
+		if(bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+			listen(listen_fd, 16) != 0)
+			return false;
+	} else {
+		path = target;
+	}
+	json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	return true;
+}
+
+void MetricsExporter::update(const Metrics &m, const std::vector<ResolverStats> &res)
+{
+	const std::string data = json ? metrics_json(m, res) : metrics_prometheus(m, res);
+
+	if(listen_fd != -1) {
+		// serve everyone who connected since the last update, without
+		// waiting for clients that don't read or dying of ones that left
+		int fd;
+		while((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+			size_t off = 0;
+			while(off < data.size()) {
+				ssize_t r = send(fd, data.c_str() + off, data.size() - off, MSG_NOSIGNAL);
+				if(r <= 0)
+					break;
+				off += r;
+			}
+			::close(fd);
+		}
+		return;
+	}
+
+	const std::string tmp = path + ".tmp";
+	{
+		std::ofstream f(tmp);
+		f << data;
+		if(!f.good())
+			return;
+	}
+	rename(tmp.c_str(), path.c_str());
+}
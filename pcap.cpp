@@ -0,0 +1,198 @@
+#include <time.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "pcap.hpp"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define LINKTYPE_RAW 101
+#define SNAPLEN 65535
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major, version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs, snaplen, linktype;
+};
+
+struct pcap_record_header {
+	uint32_t ts_sec, ts_usec, incl_len, orig_len;
+};
+
+static inline void put_u16(unsigned char *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static inline uint16_t get_u16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t swap32(uint32_t v)
+{
+	return __builtin_bswap32(v);
+}
+
+static bool is_v4mapped(const SocketAddress &addr)
+{
+	return IN6_IS_ADDR_V4MAPPED(&addr.addr.sin6_addr);
+}
+
+static uint16_t ipv4_checksum(const unsigned char *hdr)
+{
+	uint32_t sum = 0;
+	for(int i = 0; i < 20; i += 2)
+		sum += get_u16(&hdr[i]);
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/**** Writer ****/
+
+PcapWriter::~PcapWriter()
+{
+	close();
+}
+
+bool PcapWriter::open(const std::string &path)
+{
+	f = fopen(path.c_str(), "wb");
+	if(!f)
+		return false;
+	pcap_file_header hdr = { PCAP_MAGIC, 2, 4, 0, 0, SNAPLEN, LINKTYPE_RAW };
+	return fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+}
+
+void PcapWriter::write(const ustring &payload, const SocketAddress &remote, int local_port, bool outgoing)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	// IP header, our address stays zero
+	unsigned char buf[48] = { 0 };
+	size_t ip_len;
+	const size_t udp_len = 8 + payload.size();
+	if(is_v4mapped(remote)) {
+		ip_len = 20;
+		buf[0] = 0x45;
+		put_u16(&buf[2], ip_len + udp_len);
+		buf[6] = 0x40; // DF
+		buf[8] = 64; // TTL
+		buf[9] = IPPROTO_UDP;
+		memcpy(&buf[outgoing ? 16 : 12], &remote.addr.sin6_addr.s6_addr[12], 4);
+		put_u16(&buf[10], ipv4_checksum(buf));
+	} else {
+		ip_len = 40;
+		buf[0] = 0x60;
+		put_u16(&buf[4], udp_len);
+		buf[6] = IPPROTO_UDP;
+		buf[7] = 64; // hop limit
+		memcpy(&buf[outgoing ? 24 : 8], remote.addr.sin6_addr.s6_addr, 16);
+	}
+	// UDP header, without checksum
+	unsigned char *udp = &buf[ip_len];
+	put_u16(&udp[0], outgoing ? local_port : remote.getPort());
+	put_u16(&udp[2], outgoing ? remote.getPort() : local_port);
+	put_u16(&udp[4], udp_len);
+
+	pcap_record_header rec;
+	rec.ts_sec = ts.tv_sec;
+	rec.ts_usec = ts.tv_nsec / 1000;
+	rec.incl_len = rec.orig_len = ip_len + udp_len;
+
+	MutexAutoLock alock(mtx);
+	if(!f)
+		return;
+	fwrite(&rec, sizeof(rec), 1, f);
+	fwrite(buf, ip_len + 8, 1, f);
+	fwrite(payload.c_str(), payload.size(), 1, f);
+}
+
+void PcapWriter::close()
+{
+	MutexAutoLock alock(mtx);
+	if(f)
+		fclose(f);
+	f = nullptr;
+}
+
+/**** Reader ****/
+
+PcapReader::~PcapReader()
+{
+	if(f)
+		fclose(f);
+}
+
+bool PcapReader::open(const std::string &path)
+{
+	f = fopen(path.c_str(), "rb");
+	if(!f)
+		return false;
+	pcap_file_header hdr;
+	if(fread(&hdr, sizeof(hdr), 1, f) != 1)
+		return false;
+	swapped = hdr.magic == swap32(PCAP_MAGIC) || hdr.magic == swap32(PCAP_MAGIC_NSEC);
+	if(swapped)
+		hdr.magic = swap32(hdr.magic);
+	nsec = hdr.magic == PCAP_MAGIC_NSEC;
+	if(hdr.magic != PCAP_MAGIC && !nsec)
+		return false;
+	// anything else would need link layer parsing
+	return (swapped ? swap32(hdr.linktype) : hdr.linktype) == LINKTYPE_RAW;
+}
+
+bool PcapReader::next(CapturedPacket *pkt)
+{
+	ustring data;
+	while(1) {
+		pcap_record_header rec;
+		if(fread(&rec, sizeof(rec), 1, f) != 1)
+			return false;
+		if(swapped) {
+			rec.ts_sec = swap32(rec.ts_sec);
+			rec.ts_usec = swap32(rec.ts_usec);
+			rec.incl_len = swap32(rec.incl_len);
+		}
+		if(rec.incl_len > SNAPLEN)
+			return false;
+		data.resize(rec.incl_len);
+		if(rec.incl_len > 0 && fread(&data[0], rec.incl_len, 1, f) != 1)
+			return false;
+
+		size_t ip_len;
+		SocketAddress from, to;
+		if(data.size() >= 20 && (data[0] >> 4) == 4 && data[9] == IPPROTO_UDP) {
+			ip_len = (data[0] & 0xf) * 4;
+			struct in_addr a;
+			memcpy(&a, &data[12], 4);
+			from.setIPv4(a);
+			memcpy(&a, &data[16], 4);
+			to.setIPv4(a);
+		} else if(data.size() >= 40 && (data[0] >> 4) == 6 && data[6] == IPPROTO_UDP) {
+			ip_len = 40;
+			from.addr.sin6_family = to.addr.sin6_family = AF_INET6;
+			memcpy(from.addr.sin6_addr.s6_addr, &data[8], 16);
+			memcpy(to.addr.sin6_addr.s6_addr, &data[24], 16);
+		} else {
+			continue;
+		}
+		// needs at least the DNS header
+		if(data.size() < ip_len + 8 + 12)
+			continue;
+		from.setPort(get_u16(&data[ip_len]));
+		to.setPort(get_u16(&data[ip_len + 2]));
+
+		pkt->time_us = (int64_t) rec.ts_sec * 1000000 + (nsec ? rec.ts_usec / 1000 : rec.ts_usec);
+		pkt->payload.assign(data, ip_len + 8, std::string::npos);
+		pkt->outgoing = (pkt->payload[2] & 0x80) == 0;
+		pkt->remote = pkt->outgoing ? to : from;
+		return true;
+	}
+}
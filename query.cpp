@@ -1,67 +1,522 @@
 #include <stdio.h> // snprintf()
+#include <signal.h>
 #include <iostream>
 #include <fstream>
 #include <deque>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include "query.hpp"
 #include "common.hpp"
 #include "backend.hpp"
 #include "dns.hpp"
+#include "cache.hpp"
+#include "checkpoint.hpp"
+#include "metrics.hpp"
+#include "pcap.hpp"
+#include "iterative.hpp"
+#include "wildcard.hpp"
+#include "store.hpp"
+#include "chain.hpp"
+#include "filter.hpp"
+#include "trace.hpp"
+#ifdef WITH_XDP
+#include "xdp.hpp"
+#endif
 
 static void print_stats(uint32_t n_sent, uint32_t n_recv, uint32_t n_succ);
 static bool check_answer(const DNSPacket &pkt);
+static void handle_signal(int sig);
 
-int query_main(std::ostream &outfile,
-	bool quiet, unsigned concurrent,
+static volatile sig_atomic_t got_signal = 0;
+
+// ids of follow-up queries, far above the wildcard probes
+#define FOLLOW_FIRST_ID ((QueryID) 1 << 48)
+
+int query_main(std::ostream &outfile, const QueryOptions &opts,
 	std::vector<SocketAddress> &resolvers,
-	std::vector<DNSQuestion> &queries)
+	QueryList &queries)
 {
-	QueryBackend backend(resolvers, concurrent, TIMEOUT_SEC);
+	QueryBackend backend(opts.iterative ? std::vector<SocketAddress>() : resolvers,
+		opts.concurrent, TIMEOUT_SEC);
+	AnswerCache cache;
+	ResultStore store;
+	const bool use_store = !opts.store_file.empty();
+	if(use_store && !store.load(opts.store_file)) {
+		std::cerr << "Failed to load result store." << std::endl;
+		return 1;
+	}
 
-	uint32_t n_succ = 0;
+	std::atomic<uint32_t> n_succ(0), n_done(0);
+	std::atomic<uint32_t> n_conflict(0), n_wildcard(0);
+	std::atomic<uint32_t> n_fresh(0), n_changed(0);
+	std::mutex outfile_mtx, failfile_mtx;
+	const size_t n_jobs = std::max<size_t>(opts.jobs.size(), 1);
+	std::unique_ptr<std::atomic<uint32_t>[]> job_done(new std::atomic<uint32_t>[n_jobs]);
+	std::vector<bool> job_reported(n_jobs, false);
+	for(size_t j = 0; j < n_jobs; j++)
+		job_done[j] = 0;
+	auto job_of = [&] (QueryID id) -> unsigned {
+		if(opts.jobs.empty())
+			return 0;
+		auto it = std::upper_bound(opts.jobs.begin(), opts.jobs.end(), (size_t) id,
+			[] (size_t id, const QueryJob &job) { return id < job.first; });
+		return it - opts.jobs.begin() - 1;
+	};
+	// must happen while holding the lock of the file that was written to,
+	// otherwise a checkpoint could see the output without the mark (or vice versa)
+	auto mark_done = [&] (QueryID id) {
+		if(opts.checkpoint)
+			opts.checkpoint->markDone(id);
+		job_done[job_of(id)]++;
+		n_done++;
+	};
+	auto matching_records = [&] (const std::vector<DNSAnswer> &records, QueryID id,
+		std::vector<const DNSAnswer*> *matching) {
+		if(opts.filter) {
+			DNSQuestion tmp;
+			const DNSQuestion &q = queries.get(id, &tmp);
+			for(auto &a : records) {
+				if(opts.filter->matches(a, q))
+					matching->push_back(&a);
+			}
+		} else {
+			for(auto &a : records)
+				matching->push_back(&a);
+		}
+	};
+	// outfile_mtx must be held
+	auto write_matching = [&] (const std::vector<const DNSAnswer*> &matching, QueryID id) {
+		std::ostream &out = opts.jobs.empty() ? outfile : *opts.jobs[job_of(id)].outfile;
+		for(unsigned n = queries.copies(id); n > 0; n--) {
+			for(auto a : matching)
+				out << a->toString() << "\n";
+		}
+		mark_done(id);
+	};
+	auto write_records = [&] (const std::vector<DNSAnswer> &records, QueryID id) {
+		std::vector<const DNSAnswer*> matching;
+		matching_records(records, id, &matching);
+		std::lock_guard<std::mutex> lock(outfile_mtx);
+		write_matching(matching, id);
+	};
+	// same for the records of the result store, which are text already
+	auto write_lines = [&] (const std::vector<std::string> &lines, QueryID id) {
+		std::lock_guard<std::mutex> lock(outfile_mtx);
+		std::ostream &out = opts.jobs.empty() ? outfile : *opts.jobs[job_of(id)].outfile;
+		for(unsigned n = queries.copies(id); n > 0; n--) {
+			for(auto &l : lines)
+				out << l << "\n";
+		}
+		mark_done(id);
+	};
+	// returns whether the records should be written (always, unless only changes are),
+	// outfile_mtx must be held
+	auto store_answer = [&] (QueryID id, const DNSPacket &pkt) -> bool {
+		DNSQuestion tmp;
+		const DNSQuestion &q = queries.get(id, &tmp);
+		const std::string key = AnswerCache::key(q);
+		enum DNSRcode rcode = pkt.rcode();
+		if(rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN) {
+			store.markFailed(key);
+			return !opts.changes_only;
+		}
+		bool had_records;
+		if(!store.update(key, pkt, time(nullptr), &had_records))
+			return !opts.changes_only;
+		n_changed++;
+		if(opts.changes_only && had_records && !check_answer(pkt)) {
+			std::ostream &out = opts.jobs.empty() ? outfile : *opts.jobs[job_of(id)].outfile;
+			out << "; removed " << q.toString() << "\n";
+		}
+		return true;
+	};
+	auto save_checkpoint = [&] () {
+		uint64_t out_offset, fail_offset = 0;
+		std::vector<uint64_t> done;
+		{
+			std::lock_guard<std::mutex> lock(outfile_mtx), lock2(failfile_mtx);
+			outfile.flush();
+			out_offset = outfile.tellp();
+			if(opts.failfile) {
+				opts.failfile->flush();
+				fail_offset = opts.failfile->tellp();
+			}
+			opts.checkpoint->snapshot(&done);
+		}
+		// the output has to be on disk before a checkpoint refers to it,
+		// the callbacks can carry on writing past the offsets meanwhile
+		bool ok = sync_file(opts.outfile_path);
+		if(opts.failfile)
+			ok = ok && sync_file(opts.failfile_path);
+		if(!ok || !opts.checkpoint->save(opts.checkpoint_file, out_offset, fail_offset, done))
+			std::cerr << "\nWarning: Failed to write checkpoint." << std::endl;
+	};
+	// outfile_mtx and failfile_mtx must be held
+	auto flush_files = [&] () {
+		outfile.flush();
+		for(auto &job : opts.jobs)
+			job.outfile->flush();
+		if(opts.failfile)
+			opts.failfile->flush();
+	};
+	auto flush_output = [&] () {
+		std::lock_guard<std::mutex> lock(outfile_mtx), lock2(failfile_mtx);
+		flush_files();
+	};
+	// answers that are in the store aren't asked for again, so they must be
+	// in the output before. the copy is taken right after the flush and
+	// written without holding up the callbacks
+	auto save_store = [&] () {
+		ResultStore::Snapshot snapshot;
+		{
+			std::lock_guard<std::mutex> lock(outfile_mtx), lock2(failfile_mtx);
+			flush_files();
+			store.snapshot(&snapshot);
+		}
+		if(!ResultStore::save(opts.store_file, snapshot))
+			std::cerr << "\nWarning: Failed to write result store." << std::endl;
+	};
+	WildcardDetector *wildcards = nullptr;
+	if(opts.wildcards != WILDCARDS_OFF)
+		wildcards = new WildcardDetector(queries.size());
+	// the queries below the parent were held back until now
+	auto finish_probe = [&] (QueryID id, const DNSPacket *pkt) {
+		std::vector<QueryID> released;
+		bool wildcard;
+		wildcards->finishProbe(id, pkt, &released, &wildcard);
+		if(released.empty())
+			return;
+		if(wildcard) {
+			std::lock_guard<std::mutex> lock(outfile_mtx);
+			std::ostream &out = opts.jobs.empty() ? outfile : *opts.jobs[job_of(released[0])].outfile;
+			DNSQuestion q = wildcards->probe(id);
+			q.name.labels[0] = "*";
+			out << "; wildcard " << q.toString() << "\n";
+		}
+		if(wildcard && opts.wildcards == WILDCARDS_SKIP) {
+			std::lock_guard<std::mutex> lock(outfile_mtx);
+			for(QueryID r : released)
+				mark_done(r);
+			n_wildcard += released.size();
+		} else {
+			for(QueryID r : released)
+				backend.queue(r, job_of(r));
+		}
+	};
+	ChainFollower *chains = nullptr;
+	if(opts.follow)
+		chains = new ChainFollower(opts.follow, FOLLOW_FIRST_ID);
+	// the records of a chain are written together once all of its follow-ups are done
+	auto follow = [&] (QueryID id, const DNSQuestion &q, const std::vector<DNSAnswer> &records) {
+		std::vector<QueryID> next;
+		std::vector<DNSAnswer> chain;
+		bool done = chains->answer(id, q, records, &next, &chain);
+		const QueryID origin = chains->origin(id);
+		for(QueryID f : next)
+			backend.queue(f, job_of(origin));
+		if(done)
+			write_records(chain, origin);
+	};
 	auto cb_query = [&] (QueryID id) -> DNSQuestion {
+		if(chains && chains->isFollowUp(id))
+			return chains->question(id);
+		if(wildcards && wildcards->isProbe(id))
+			return wildcards->probe(id);
 		return queries[id];
 	};
 	auto cb_answer = [&] (const DNSPacket &pkt, QueryID id) {
-		bool has_records = check_answer(pkt);
+		if(chains && chains->isFollowUp(id)) {
+			follow(id, chains->question(id), check_answer(pkt) ? pkt.answers : std::vector<DNSAnswer>());
+			return;
+		}
+		if(wildcards && wildcards->isProbe(id)) {
+			finish_probe(id, &pkt);
+			return;
+		}
+		DNSQuestion tmp;
+		const DNSQuestion &q = queries.get(id, &tmp);
+		bool has_records = check_answer(pkt), done = false;
+		if(has_records && wildcards && wildcards->matches(q, pkt)) {
+			has_records = false;
+			n_wildcard++;
+		} else if(use_store) {
+			// the store must not get ahead of the output (see save_store),
+			// so the lock is held from the update until the records are written
+			std::vector<const DNSAnswer*> matching;
+			if(has_records)
+				matching_records(pkt.answers, id, &matching);
+			std::lock_guard<std::mutex> lock(outfile_mtx);
+			if(store_answer(id, pkt) && has_records)
+				write_matching(matching, id);
+			else
+				mark_done(id);
+			done = true;
+		}
 		if(has_records) {
-			for(auto &a : pkt.answers)
-				outfile << a.toString() << "\n";
+			if(chains)
+				follow(id, q, pkt.answers);
+			else if(!done)
+				write_records(pkt.answers, id);
+			cache.insertTargets(q, pkt);
+		} else {
+			// with a CNAME the NXDOMAIN is about its target
+			if(opts.nxdomain_cut && pkt.rcode() == DNS_RCODE_NXDOMAIN && pkt.answers.empty())
+				cache.insertNxdomain(q.name);
+			if(!done)
+				mark_done(id);
 		}
 		n_succ += has_records ? 1 : 0;
 	};
-	auto cb_timeout = [&] (QueryID id) {
-		// retry query
-		backend.queue(id);
+	auto cb_fail = [&] (QueryID id) {
+		if(chains && chains->isFollowUp(id)) {
+			follow(id, chains->question(id), std::vector<DNSAnswer>());
+			return;
+		}
+		if(wildcards && wildcards->isProbe(id)) {
+			finish_probe(id, nullptr);
+			return;
+		}
+		if(use_store)
+			store.markFailed(AnswerCache::key(queries[id]));
+		std::lock_guard<std::mutex> lock(failfile_mtx);
+		if(opts.failfile) {
+			for(unsigned n = queries.copies(id); n > 0; n--)
+				*opts.failfile << queries[id].toString() << "\n";
+		}
+		mark_done(id);
 	};
-	backend.setCallbacks(cb_query, cb_answer, cb_timeout);
+	auto cb_local = [&] (QueryID id) -> bool {
+		if(chains && chains->isFollowUp(id))
+			return false;
+		if(wildcards && wildcards->isProbe(id))
+			return false;
+		DNSQuestion tmp;
+		const DNSQuestion &q = queries.get(id, &tmp);
+		ResultStore::Entry se;
+		if(use_store && store.lookup(AnswerCache::key(q), &se) && se.fresh(time(nullptr))) {
+			if(opts.changes_only)
+				mark_done(id);
+			else
+				write_lines(se.records, id);
+			n_fresh++;
+			n_succ += se.records.empty() ? 0 : 1;
+			return true;
+		}
+		AnswerCache::Entry e;
+		if(!cache.lookup(q, &e))
+			return false;
+		// like any other answer, it may need follow-ups
+		if(chains)
+			follow(id, q, e.records);
+		else
+			write_records(e.records, id);
+		n_succ += e.records.empty() ? 0 : 1;
+		return true;
+	};
+	IterativeResolver *iterative = nullptr;
+	if(opts.iterative) {
+		iterative = new IterativeResolver(backend);
+		iterative->setCallbacks(cb_query, cb_answer, cb_fail);
+		iterative->setLocalCallback(cb_local);
+		if(resolvers.empty()) {
+			iterative->addRootHints();
+		} else {
+			DNSName zone;
+			zone.parse(opts.stub_zone);
+			iterative->addStub(zone, resolvers);
+		}
+	} else {
+		backend.setCallbacks(cb_query, cb_answer, cb_fail);
+		backend.setLocalCallback(cb_local);
+	}
+	configure_backend(backend, opts);
+	if(queries.multiType() && !opts.iterative && opts.affinity_labels == 0 && opts.consensus < 2) {
+		// the types of a name go to the same resolver, which then has the
+		// delegation to its zone cached already. not with --consensus, its
+		// copies have to go to different resolvers anyway
+		AffinityPolicy policy = affinity_policy(opts);
+		policy.labels = UINT_MAX;
+		policy.resolvers = 1;
+		backend.setAffinityPolicy(policy);
+	}
+	if(opts.consensus > 1) {
+		auto cb_conflict = [&] (QueryID id, unsigned agree, unsigned total) {
+			if(chains && chains->isFollowUp(id))
+				return;
+			if(wildcards && wildcards->isProbe(id))
+				return;
+			std::lock_guard<std::mutex> lock(outfile_mtx);
+			std::ostream &out = opts.jobs.empty() ? outfile : *opts.jobs[job_of(id)].outfile;
+			out << "; conflicting answers for " << queries[id].name.toString()
+				<< " (" << agree << " of " << total << " agree)\n";
+			n_conflict++;
+		};
+		backend.setConsensus(opts.consensus, cb_conflict);
+	}
 
-	for(size_t i = 0; i < queries.size(); i++)
-		backend.queue(i);
+	for(size_t j = 0; j < opts.jobs.size(); j++)
+		backend.setJobWeight(j, opts.jobs[j].weight);
+	if(wildcards) {
+		for(size_t i = 0; i < queries.size(); i++) {
+			if(!opts.checkpoint || !opts.checkpoint->isDone(i))
+				wildcards->count(queries[i]);
+		}
+	}
+	std::vector<size_t> order;
+	if(opts.parents_first) {
+		// so that NXDOMAIN for a parent can save the queries below it
+		order.resize(queries.size());
+		std::vector<size_t> labels(queries.size());
+		for(size_t i = 0; i < order.size(); i++) {
+			order[i] = i;
+			labels[i] = queries[i].name.labels.size();
+		}
+		std::stable_sort(order.begin(), order.end(), [&labels] (size_t a, size_t b) {
+			return labels[a] < labels[b];
+		});
+	}
+	// walks the list in sending order, skipping what completed previously
+	// and what wildcard detection holds back (queueing its probes instead)
+	std::atomic<size_t> cursor(0);
+	std::vector<QueryID> probes;
+	auto next_query = [&] (QueryID *id) -> bool {
+		while(cursor < queries.size()) {
+			const size_t n = cursor++;
+			const size_t i = order.empty() ? n : order[n];
+			if(opts.checkpoint && opts.checkpoint->isDone(i))
+				continue;
+			if(wildcards && wildcards->hold(i, queries[i])) {
+				wildcards->takeProbes(&probes);
+				for(QueryID p : probes)
+					backend.queue(p, job_of(i));
+				probes.clear();
+				continue;
+			}
+			*id = i;
+			return true;
+		}
+		return false;
+	};
+	if(queries.mapped() && !wildcards) {
+		// a compiled list can be huge, its queries are taken as they are sent.
+		// (wildcard detection has to see all of them before the first probe
+		// is answered, so it still queues everything)
+		backend.setSource(next_query);
+	} else {
+		QueryID id;
+		while(next_query(&id))
+			backend.queue(id, job_of(id));
+	}
+	if(opts.checkpoint)
+		n_done = opts.checkpoint->countDone();
+	if(opts.checkpoint || use_store || trace_requested()) {
+		signal(SIGINT, handle_signal);
+		signal(SIGTERM, handle_signal);
+	}
 
-	std::cerr << "Running with " << resolvers.size() << " resolvers and " << queries.size() << " queries." << std::endl;
+	if(opts.iterative && resolvers.empty())
+		std::cerr << "Running iteratively from the root with " << queries.size() << " queries";
+	else if(opts.iterative)
+		std::cerr << "Running iteratively from " << opts.stub_zone << " (" << resolvers.size() << " servers) with " << queries.size() << " queries";
+	else
+		std::cerr << "Running with " << resolvers.size() << " resolvers and " << queries.size() << " queries";
+	if(!queries.duplicates.empty())
+		std::cerr << " (" << queries.duplicates.size() << " with duplicates)";
+	if(n_done > 0)
+		std::cerr << ", " << n_done << " of them completed previously";
+	std::cerr << "." << std::endl;
+	for(auto &job : opts.jobs)
+		std::cerr << "Job " << job.name << ": " << job.count << " queries, weight " << job.weight << std::endl;
 	std::cerr << std::endl;
+	const int64_t time_start = time(nullptr);
+
+	MetricsExporter exporter;
+	if(!opts.metrics_target.empty() && !exporter.open(opts.metrics_target)) {
+		std::cerr << "Failed to open metrics target." << std::endl;
+		return 1;
+	}
+	std::vector<ResolverStats> resolver_stats;
+	PcapWriter recorder;
+	if(!opts.record_file.empty()) {
+		if(!recorder.open(opts.record_file)) {
+			std::cerr << "Failed to open capture file." << std::endl;
+			return 1;
+		}
+		backend.setRecorder(&recorder);
+	}
+#ifdef WITH_XDP
+	if(!opts.xdp_interface.empty()) {
+		std::unique_ptr<XdpSocket> sock(new XdpSocket());
+		bool ok = sock->open(opts.xdp_interface);
+		for(auto it = resolvers.begin(); ok && it != resolvers.end(); it++)
+			ok = sock->addDestination(*it);
+		if(!ok) {
+			std::cerr << "Failed to set up AF_XDP socket: " << sock->getError() << std::endl;
+			return 1;
+		}
+		backend.setSocket(sock.release());
+	}
+#endif
 
 	backend.start();
 
 	{
 		uint32_t n_sent, n_queue, n_recv;
-		uint32_t prev_n_sent = 0, hang_count = 0;
+		uint32_t prev_n_sent = 0, hang_count = 0, ticks = 0;
 		do {
 			backend.getStats(&n_sent, &n_queue, &n_recv);
-			if(!quiet)
+			if(!opts.quiet)
 				print_stats(n_sent, n_recv, n_succ);
+			if(!opts.metrics_target.empty()) {
+				backend.getResolverStats(&resolver_stats);
+				exporter.update(backend.getMetrics(), resolver_stats);
+			}
+
+			for(size_t j = 0; j < opts.jobs.size(); j++) {
+				if(job_reported[j] || job_done[j] < opts.jobs[j].count)
+					continue;
+				job_reported[j] = true;
+				std::cerr << "\nJob " << opts.jobs[j].name << " finished after "
+					<< (time(nullptr) - time_start) << " seconds." << std::endl;
+			}
 
+			if(n_done == queries.size())
+				break;
+			ticks++;
+			if(opts.checkpoint && ticks % CHECKPOINT_INTERVAL_SEC == 0)
+				save_checkpoint();
+			if(use_store && ticks % STORE_SAVE_INTERVAL_SEC == 0)
+				save_store();
+			if(got_signal) {
+				if(opts.checkpoint)
+					save_checkpoint();
+				else
+					flush_output();
+				if(use_store)
+					save_store();
+				recorder.close();
+				std::cerr << "\nInterrupted, progress was saved." << std::endl;
+				trace_dump_before_exit();
+				_Exit(1);
+			}
 			if(n_sent == prev_n_sent) {
-				if(++hang_count == TIMEOUT_SEC + 1) {
-					if(n_queue > 0) {
-						std::cerr << "\nError: No resolvers are responding anymore, exiting." << std::endl;
-						outfile.flush();
-						_Exit(1); // hard exit
-					}
-					break;
+				// queries still waiting for an answer or their backoff
+				// to expire will complete eventually, a full send queue won't
+				if(++hang_count >= TIMEOUT_SEC + 1 && (n_queue > 0 || cursor < queries.size())) {
+					std::cerr << "\nError: No resolvers are responding anymore, exiting." << std::endl;
+					if(use_store)
+						save_store();
+					if(opts.checkpoint)
+						save_checkpoint();
+					else
+						flush_output();
+					recorder.close();
+					trace_dump_before_exit();
+					_Exit(1); // hard exit
 				}
 			} else {
 				hang_count = 0;
@@ -73,11 +528,75 @@ int query_main(std::ostream &outfile,
 	}
 
 	backend.stopJoin();
+	if(opts.checkpoint)
+		save_checkpoint();
+	if(use_store)
+		save_store();
+	backend.getResolverStats(&resolver_stats);
+	if(!opts.metrics_target.empty())
+		exporter.update(backend.getMetrics(), resolver_stats);
+	std::cerr << "\n\n" << metrics_summary(backend.getMetrics(), resolver_stats);
+	if(cache.hits() > 0)
+		std::cerr << "\n" << cache.hits() << " queries were answered from cache.";
+	if(chains)
+		std::cerr << "\n" << chains->followUpCount() << " follow-up queries were sent.";
+	if(n_fresh > 0)
+		std::cerr << "\n" << n_fresh << " queries still had a fresh answer in the result store and were not sent.";
+	if(use_store)
+		std::cerr << "\n" << n_changed << " answers changed, the result store has " << store.size() << " entries.";
+	if(cache.nxdomainHits() > 0)
+		std::cerr << "\n" << cache.nxdomainHits() << " queries were below a nonexistent name and not sent.";
+	if(n_conflict > 0)
+		std::cerr << "\n" << n_conflict << " queries had conflicting answers.";
+	if(wildcards) {
+		std::cerr << "\nFound " << wildcards->wildcardCount() << " wildcards, " << n_wildcard << " queries were "
+			<< (opts.wildcards == WILDCARDS_SKIP ? "skipped." : "answered by one.");
+	}
+	if(iterative) {
+		std::cerr << "\nLearned " << iterative->zoneCount() << " zones, "
+			<< iterative->lookupCount() << " name server addresses had to be looked up.";
+	}
 	std::cerr << "\nDone!" << std::endl;
 
 	return 0;
 }
 
+void configure_backend(QueryBackend &backend, const QueryOptions &opts)
+{
+	backend.setRetryPolicy(retry_policy(opts));
+	if(opts.hedge_percentile > 0)
+		backend.setHedgePolicy(hedge_policy(opts));
+	backend.setAffinityPolicy(affinity_policy(opts));
+}
+
+RetryPolicy retry_policy(const QueryOptions &opts)
+{
+	RetryPolicy policy;
+	policy.max_retries = opts.max_retries;
+	policy.backoff = opts.backoff;
+	// lame delegations are common, try another server
+	policy.retry_errors = opts.retry_errors || opts.iterative;
+	return policy;
+}
+
+HedgePolicy hedge_policy(const QueryOptions &opts)
+{
+	HedgePolicy policy;
+	policy.enabled = opts.hedge_percentile > 0;
+	policy.percentile = opts.hedge_percentile;
+	policy.budget = opts.hedge_budget / 100.f;
+	policy.when_drained = opts.hedge_tail;
+	return policy;
+}
+
+AffinityPolicy affinity_policy(const QueryOptions &opts)
+{
+	AffinityPolicy policy;
+	policy.labels = opts.affinity_labels;
+	policy.resolvers = opts.affinity_resolvers;
+	return policy;
+}
+
 static void print_stats(uint32_t n_sent, uint32_t n_recv, uint32_t n_succ)
 {
 	char buf[512];
@@ -90,6 +609,11 @@ static void print_stats(uint32_t n_sent, uint32_t n_recv, uint32_t n_succ)
 	std::cerr.flush();
 }
 
+static void handle_signal(int sig)
+{
+	got_signal = 1;
+}
+
 static bool check_answer(const DNSPacket &pkt)
 {
 	uint16_t rcode = pkt.flags & 0xf;
@@ -4,6 +4,7 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <poll.h>
+#include <stdlib.h> // atoi()
 
 #include "socket.hpp"
 
@@ -34,6 +35,61 @@ bool SocketAddress::parseIP(const std::string &s)
 	return true;
 }
 
+void SocketAddress::setIPv4(const struct in_addr &ip)
+{
+	static const unsigned char b[12] =
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff }; // the ::ffff: prefix
+	addr.sin6_family = AF_INET6;
+	memcpy(addr.sin6_addr.s6_addr, b, 12);
+	memcpy(&addr.sin6_addr.s6_addr[12], &ip.s_addr, 4);
+}
+
+bool SocketAddress::parse(const std::string &s, int default_port)
+{
+	std::string ip = s;
+	int port = default_port;
+
+	size_t colon = s.rfind(':');
+	if(!s.empty() && s[0] == '[') {
+		size_t end = s.find(']');
+		if(end == std::string::npos)
+			return false;
+		ip = s.substr(1, end - 1);
+		if(end + 1 < s.size()) {
+			if(s[end + 1] != ':')
+				return false;
+			port = atoi(s.c_str() + end + 2);
+		}
+	} else if(colon != std::string::npos && s.find(':') == colon) {
+		// exactly one colon -> ipv4 with port
+		ip = s.substr(0, colon);
+		port = atoi(s.c_str() + colon + 1);
+	}
+	if(port <= 0 || port > 0xffff)
+		return false;
+
+	if(!parseIP(ip))
+		return false;
+	setPort(port);
+	return true;
+}
+
+std::string SocketAddress::toString(bool with_port) const
+{
+	static const unsigned char b[12] =
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff }; // the ::ffff: prefix
+	char buf[INET6_ADDRSTRLEN];
+	bool v4 = !memcmp(addr.sin6_addr.s6_addr, b, 12);
+	if(v4)
+		inet_ntop(AF_INET, &addr.sin6_addr.s6_addr[12], buf, sizeof(buf));
+	else
+		inet_ntop(AF_INET6, &addr.sin6_addr, buf, sizeof(buf));
+	if(!with_port)
+		return std::string(buf);
+	const std::string port = std::to_string(getPort());
+	return v4 ? std::string(buf) + ":" + port : "[" + std::string(buf) + "]:" + port;
+}
+
 int SocketAddress::getPort() const
 {
 	return ntohs(addr.sin6_port);
@@ -50,6 +106,11 @@ Socket::Socket()
 	fd = socket(AF_INET6, SOCK_DGRAM, 0);
 	if(fd == -1)
 		throw SocketException();
+	// what sendto() would do, but this way the local port is known right away
+	struct sockaddr_in6 addr = {};
+	addr.sin6_family = AF_INET6;
+	if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+		throw SocketException();
 }
 
 Socket::~Socket()
@@ -93,8 +154,49 @@ short Socket::poll(short events, int timeout)
 	return pfd.revents;
 }
 
+int Socket::getLocalPort()
+{
+	struct sockaddr_in6 addr;
+	socklen_t addrlen = sizeof(addr);
+	if(getsockname(fd, (struct sockaddr*) &addr, &addrlen) != 0)
+		return 0;
+	return ntohs(addr.sin6_port);
+}
+
 void Socket::close()
 {
 	::close(fd);
 	fd = -1;
 }
+
+LineConn::~LineConn()
+{
+	::close(fd);
+}
+
+bool LineConn::readLine(std::string *line)
+{
+	size_t pos;
+	while((pos = buf.find('\n')) == std::string::npos) {
+		char tmp[4096];
+		ssize_t r = recv(fd, tmp, sizeof(tmp), 0);
+		if(r <= 0)
+			return false;
+		buf.append(tmp, r);
+	}
+	line->assign(buf, 0, pos);
+	buf.erase(0, pos + 1);
+	return true;
+}
+
+bool LineConn::write(const std::string &data)
+{
+	size_t off = 0;
+	while(off < data.size()) {
+		ssize_t r = send(fd, data.c_str() + off, data.size() - off, MSG_NOSIGNAL);
+		if(r <= 0)
+			return false;
+		off += r;
+	}
+	return true;
+}
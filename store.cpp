@@ -0,0 +1,220 @@
+#include <stdio.h> // rename()
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h> // fsync()
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "store.hpp"
+
+/*
+	File format (all integers little endian), entries are sorted by key:
+	u32 magic
+	u64 number of entries
+	entries[]:
+		u16 key length, key
+		i64 time
+		u32 ttl
+		u8 rcode (0xff = failed)
+		u32 number of records
+		records[]:
+			u16 length, text
+*/
+static const uint32_t MAGIC = 0x53524844; // "DHRS"
+static const uint8_t RCODE_FAILED = 0xff;
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+static void writeU64(std::ostream &s, uint64_t v)
+{
+	v = htole64(v);
+	s.write((char*) &v, 8);
+}
+
+static void writeU32(std::ostream &s, uint32_t v)
+{
+	v = htole32(v);
+	s.write((char*) &v, 4);
+}
+
+static void writeString(std::ostream &s, const std::string &str)
+{
+	uint16_t len = htole16(str.size());
+	s.write((char*) &len, 2);
+	s.write(str.data(), str.size());
+}
+
+static uint64_t readU64(std::istream &s)
+{
+	uint64_t v = 0;
+	s.read((char*) &v, 8);
+	return le64toh(v);
+}
+
+static uint32_t readU32(std::istream &s)
+{
+	uint32_t v = 0;
+	s.read((char*) &v, 4);
+	return le32toh(v);
+}
+
+// fsync() before the rename, as for the checkpoint
+static bool sync_file(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd == -1)
+		return false;
+	int r = fsync(fd);
+	close(fd);
+	return r == 0;
+}
+
+static std::string readString(std::istream &s)
+{
+	uint16_t len = 0;
+	s.read((char*) &len, 2);
+	std::string ret(le16toh(len), '\0');
+	s.read(&ret[0], ret.size());
+	return ret;
+}
+
+// records without their TTL, in a fixed order
+static std::vector<std::string> normalize(const std::vector<std::string> &records)
+{
+	std::vector<std::string> ret;
+	for(auto &r : records) {
+		// name \t ttl \t class \t type \t data
+		size_t a = r.find('\t'), b = r.find('\t', a + 1);
+		if(a == std::string::npos || b == std::string::npos)
+			ret.push_back(r);
+		else
+			ret.push_back(r.substr(0, a) + r.substr(b));
+	}
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+bool ResultStore::load(const std::string &path)
+{
+	std::ifstream f(path, std::ios::binary);
+	if(!f.is_open())
+		return errno == ENOENT;
+	uint32_t magic = 0;
+	f.read((char*) &magic, 4);
+	if(!f.good() || le32toh(magic) != MAGIC) {
+		std::cerr << "Not a valid result store." << std::endl;
+		return false;
+	}
+
+	MutexAutoLock alock(mtx);
+	uint64_t n = readU64(f);
+	entries.reserve(n);
+	for(uint64_t i = 0; i < n && f.good(); i++) {
+		std::string key = readString(f);
+		Entry e;
+		e.time = readU64(f);
+		e.ttl = readU32(f);
+		uint8_t rcode = 0;
+		f.read((char*) &rcode, 1);
+		e.failed = rcode == RCODE_FAILED;
+		e.rcode = e.failed ? DNS_RCODE_NOERROR : (enum DNSRcode) rcode;
+		uint32_t n_records = readU32(f);
+		for(uint32_t j = 0; j < n_records && f.good(); j++)
+			e.records.push_back(readString(f));
+		entries.emplace(std::move(key), std::move(e));
+	}
+	if(!f.good()) {
+		std::cerr << "Result store is truncated." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void ResultStore::snapshot(Snapshot *s)
+{
+	MutexAutoLock alock(mtx);
+	s->assign(entries.begin(), entries.end());
+}
+
+bool ResultStore::save(const std::string &path, Snapshot &s)
+{
+	std::sort(s.begin(), s.end(), [] (const Snapshot::value_type &a, const Snapshot::value_type &b) {
+		return a.first < b.first;
+	});
+
+	// write to a temporary file first, like the checkpoint
+	const std::string tmp = path + ".tmp";
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		uint32_t magic = htole32(MAGIC);
+		f.write((char*) &magic, 4);
+		writeU64(f, s.size());
+		for(auto &it : s) {
+			const Entry &e = it.second;
+			writeString(f, it.first);
+			writeU64(f, e.time);
+			writeU32(f, e.ttl);
+			uint8_t rcode = e.failed ? RCODE_FAILED : e.rcode;
+			f.write((char*) &rcode, 1);
+			writeU32(f, e.records.size());
+			for(auto &r : e.records)
+				writeString(f, r);
+		}
+		f.flush();
+		if(!f.good())
+			return false;
+	}
+	if(!sync_file(tmp))
+		return false;
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool ResultStore::lookup(const std::string &key, Entry *e)
+{
+	MutexAutoLock alock(mtx);
+	auto it = entries.find(key);
+	if(it == entries.end())
+		return false;
+	*e = it->second;
+	return true;
+}
+
+bool ResultStore::update(const std::string &key, const DNSPacket &pkt, int64_t now, bool *had_records)
+{
+	Entry e;
+	e.time = now;
+	e.rcode = pkt.rcode();
+	if(e.rcode == DNS_RCODE_NOERROR) {
+		for(auto &a : pkt.answers)
+			e.records.push_back(a.toString());
+	}
+	if(!e.records.empty()) {
+		int32_t ttl = INT32_MAX;
+		for(auto &a : pkt.answers)
+			ttl = std::min(ttl, a.ttl);
+		e.ttl = std::max(ttl, 0);
+	} else {
+		// RFC 2308: negative answers are cached as long as the SOA record
+		// (its MINIMUM field would be the other limit, but it is not decoded)
+		e.ttl = STORE_NEGATIVE_TTL;
+		for(auto &a : pkt.authority) {
+			if(a.type == DNS_TYPE_SOA)
+				e.ttl = std::max(a.ttl, 0);
+		}
+	}
+
+	MutexAutoLock alock(mtx);
+	Entry &old = entries[key];
+	*had_records = !old.records.empty();
+	bool changed = normalize(old.records) != normalize(e.records);
+	old = std::move(e);
+	return changed;
+}
+
+void ResultStore::markFailed(const std::string &key)
+{
+	MutexAutoLock alock(mtx);
+	entries[key].failed = true;
+}
@@ -0,0 +1,122 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "trace.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+struct TraceEvent {
+	const char *name;
+	int64_t start, duration; // nanoseconds
+};
+
+struct TraceBuffer {
+	std::string thread;
+	unsigned tid;
+	std::vector<TraceEvent> events;
+	uint64_t n = 0; // total, the last TRACE_EVENTS are kept
+};
+
+static inline int64_t clock_monotonic_ns();
+static TraceBuffer *thread_buffer();
+
+static std::mutex buffers_mtx;
+// kept until the end, threads can exit before the spans are written
+static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+static thread_local TraceBuffer *buffer = nullptr;
+static std::string dump_path;
+
+TraceSpan::TraceSpan(const char *name) : name(name)
+{
+	start = clock_monotonic_ns();
+}
+
+TraceSpan::~TraceSpan()
+{
+	TraceBuffer *b = thread_buffer();
+	TraceEvent &ev = b->events[b->n % TRACE_EVENTS];
+	ev.name = name;
+	ev.start = start;
+	ev.duration = clock_monotonic_ns() - start;
+	b->n++;
+}
+
+void trace_thread_name(const char *name)
+{
+	thread_buffer()->thread = name;
+}
+
+static void dump_at_exit()
+{
+	if(!trace_dump(dump_path))
+		fprintf(stderr, "Failed to write trace file.\n");
+}
+
+void trace_dump_at_exit(const std::string &path)
+{
+	dump_path = path;
+	atexit(dump_at_exit);
+}
+
+bool trace_requested()
+{
+	return !dump_path.empty();
+}
+
+void trace_dump_before_exit()
+{
+	if(!dump_path.empty())
+		dump_at_exit();
+}
+
+bool trace_dump(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	if(!f)
+		return false;
+
+	MutexAutoLock alock(buffers_mtx);
+	fprintf(f, "{\"traceEvents\":[\n");
+	bool first = true;
+	for(auto &b : buffers) {
+		if(!b->thread.empty()) {
+			fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+				"\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", b->tid, b->thread.c_str());
+			first = false;
+		}
+		uint64_t i = b->n > TRACE_EVENTS ? b->n - TRACE_EVENTS : 0;
+		for(; i < b->n; i++) {
+			const TraceEvent &ev = b->events[i % TRACE_EVENTS];
+			// timestamps are in microseconds
+			fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				first ? "" : ",\n", ev.name, b->tid, ev.start / 1e3, ev.duration / 1e3);
+			first = false;
+		}
+	}
+	fprintf(f, "\n]}\n");
+	return fclose(f) == 0;
+}
+
+static TraceBuffer *thread_buffer()
+{
+	if(!buffer) {
+		TraceBuffer *b = new TraceBuffer();
+		b->events.resize(TRACE_EVENTS);
+		MutexAutoLock alock(buffers_mtx);
+		b->tid = buffers.size() + 1;
+		buffers.emplace_back(b);
+		buffer = b;
+	}
+	return buffer;
+}
+
+static inline int64_t clock_monotonic_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
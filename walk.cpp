@@ -0,0 +1,235 @@
+#include <ctype.h>
+#include <arpa/inet.h> // inet_pton()
+#include <strings.h> // strcasecmp()
+#include <iostream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "walk.hpp"
+#include "query.hpp"
+#include "backend.hpp"
+#include "metrics.hpp"
+#include "pcap.hpp"
+#include "input.hpp"
+#include "dns.hpp"
+#include "filter.hpp"
+#include "trace.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+static const char nibbles[] = "0123456789abcdef";
+
+// ip6.arpa name of the first len bits of addr
+static DNSName prefix_name(const struct in6_addr &addr, unsigned len)
+{
+	DNSName name;
+	for(unsigned i = len / 4; i > 0; i--) {
+		unsigned char b = addr.s6_addr[(i - 1) / 2];
+		name.labels.emplace_back(1, nibbles[(i % 2) ? (b >> 4) : (b & 0xf)]);
+	}
+	name.labels.emplace_back("ip6");
+	name.labels.emplace_back("arpa");
+	return name;
+}
+
+static bool is_walk_name(const DNSName &name)
+{
+	const size_t n = name.labels.size();
+	if(n < 2 || n - 2 > WALK_MAX_NIBBLES)
+		return false;
+	if(strcasecmp(name.labels[n - 2].c_str(), "ip6") != 0 ||
+		strcasecmp(name.labels[n - 1].c_str(), "arpa") != 0)
+		return false;
+	for(size_t i = 0; i < n - 2; i++) {
+		if(name.labels[i].size() != 1 || !isxdigit(name.labels[i][0]))
+			return false;
+	}
+	return true;
+}
+
+bool parse_walk_list(std::istream &s, std::vector<DNSName> &res)
+{
+	const std::set<char> whitespace{' ', '\t', '\r', '\n'};
+	std::string line;
+	while(std::getline(s, line)) {
+		trim(line, whitespace);
+		if(line.empty() || line[0] == '#')
+			continue; // skip comments and empty lines
+
+		DNSName name;
+		size_t slash = line.find('/');
+		if(slash != std::string::npos) {
+			struct in6_addr addr;
+			std::istringstream iss(line.substr(slash + 1));
+			int len = -1;
+			iss >> len;
+			if(inet_pton(AF_INET6, line.substr(0, slash).c_str(), &addr) != 1 ||
+				len < 0 || len > 128 || len % 4 != 0) {
+				std::cerr << "\"" << line << "\" is not a valid nibble-aligned IPv6 prefix." << std::endl;
+				return false;
+			}
+			name = prefix_name(addr, len);
+		} else {
+			try {
+				name.parse(line);
+			} catch(DecodeException &e) {
+			}
+			if(!is_walk_name(name)) {
+				std::cerr << "\"" << line << "\" is not a valid ip6.arpa name." << std::endl;
+				return false;
+			}
+		}
+		res.push_back(name);
+	}
+	return true;
+}
+
+int walk_main(std::ostream &outfile, const QueryOptions &opts,
+	std::vector<SocketAddress> &resolvers, const std::vector<DNSName> &start)
+{
+	QueryBackend backend(resolvers, opts.concurrent, TIMEOUT_SEC);
+	configure_backend(backend, opts);
+
+	// nodes of the tree that were queried, the id is the index
+	std::mutex mtx;
+	std::deque<DNSName> nodes(start.begin(), start.end());
+	std::atomic<uint32_t> n_done(0), n_found(0), n_pruned(0);
+	std::mutex outfile_mtx, failfile_mtx;
+
+	auto cb_query = [&] (QueryID id) -> DNSQuestion {
+		DNSQuestion q;
+		{
+			MutexAutoLock alock(mtx);
+			q.name = nodes[id];
+		}
+		q.qtype = DNS_TYPE_PTR;
+		q.qclass = DNS_CLASS_IN;
+		return q;
+	};
+	auto cb_fail = [&] (QueryID id) {
+		if(opts.failfile) {
+			DNSName name;
+			{
+				MutexAutoLock alock(mtx);
+				name = nodes[id];
+			}
+			std::lock_guard<std::mutex> lock(failfile_mtx);
+			*opts.failfile << name.toString() << "\tPTR\n";
+		}
+		n_done++;
+	};
+	auto cb_answer = [&] (const DNSPacket &pkt, QueryID id) {
+		if(pkt.rcode() == DNS_RCODE_NXDOMAIN) {
+			n_pruned++;
+			n_done++;
+			return;
+		} else if(pkt.rcode() != DNS_RCODE_NOERROR) {
+			cb_fail(id);
+			return;
+		}
+
+		bool found = false;
+		{
+			const DNSQuestion q = opts.filter ? cb_query(id) : DNSQuestion();
+			std::lock_guard<std::mutex> lock(outfile_mtx);
+			for(auto &a : pkt.answers) {
+				if(a.type != DNS_TYPE_PTR)
+					continue;
+				found = true;
+				if(!opts.filter || opts.filter->matches(a, q))
+					outfile << a.toString() << "\n";
+			}
+		}
+		n_found += found ? 1 : 0;
+
+		// the node exists, so descend into all of its children
+		QueryID first = 0, last = 0;
+		{
+			MutexAutoLock alock(mtx);
+			const DNSName &parent = nodes[id];
+			if(parent.labels.size() - 2 < WALK_MAX_NIBBLES) {
+				first = nodes.size();
+				for(int i = 0; i < 16; i++) {
+					DNSName child;
+					child.labels.reserve(parent.labels.size() + 1);
+					child.labels.emplace_back(1, nibbles[i]);
+					child.labels.insert(child.labels.end(), parent.labels.begin(), parent.labels.end());
+					nodes.push_back(child);
+				}
+				last = nodes.size();
+			}
+		}
+		for(QueryID c = first; c < last; c++)
+			backend.queue(c);
+		// only now, so that the main loop doesn't see the walk as finished
+		n_done++;
+	};
+	backend.setCallbacks(cb_query, cb_answer, cb_fail);
+	PcapWriter recorder;
+	if(!opts.record_file.empty()) {
+		if(!recorder.open(opts.record_file)) {
+			std::cerr << "Failed to open capture file." << std::endl;
+			return 1;
+		}
+		backend.setRecorder(&recorder);
+	}
+
+	for(size_t i = 0; i < start.size(); i++)
+		backend.queue(i);
+
+	std::cerr << "Walking " << start.size() << " prefixes with " << resolvers.size() << " resolvers." << std::endl;
+	std::cerr << std::endl;
+
+	backend.start();
+
+	{
+		uint32_t n_sent, n_queue, n_recv;
+		uint32_t prev_n_sent = 0, hang_count = 0;
+		do {
+			backend.getStats(&n_sent, &n_queue, &n_recv);
+			// children are added before their parent counts as done, so read this first
+			const uint32_t done = n_done;
+			size_t n_nodes;
+			{
+				MutexAutoLock alock(mtx);
+				n_nodes = nodes.size();
+			}
+			if(!opts.quiet) {
+				std::cerr << "queried " << done << " of " << n_nodes << " nodes, found "
+					<< n_found << " names, pruned " << n_pruned << "\r";
+				std::cerr.flush();
+			}
+
+			if(done == n_nodes)
+				break;
+			if(n_sent == prev_n_sent) {
+				if(++hang_count >= TIMEOUT_SEC + 1 && n_queue > 0) {
+					std::cerr << "\nError: No resolvers are responding anymore, exiting." << std::endl;
+					outfile.flush();
+					if(opts.failfile)
+						opts.failfile->flush();
+					recorder.close();
+					trace_dump_before_exit();
+					_Exit(1); // hard exit
+				}
+			} else {
+				hang_count = 0;
+			}
+
+			prev_n_sent = n_sent;
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		} while(1);
+	}
+
+	backend.stopJoin();
+	std::vector<ResolverStats> resolver_stats;
+	backend.getResolverStats(&resolver_stats);
+	std::cerr << "\n\n" << metrics_summary(backend.getMetrics(), resolver_stats);
+	std::cerr << "\nQueried " << n_done << " nodes, " << n_pruned << " of them did not exist, "
+		<< n_found << " had PTR records.";
+	std::cerr << "\nDone!" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include <chrono>
+
+#include "wildcard.hpp"
+#include "cache.hpp"
+#include "dns.hpp"
+
+using MutexAutoLock = std::unique_lock<std::mutex>;
+
+WildcardDetector::WildcardDetector(QueryID first_probe) :
+	first_probe(first_probe),
+	rng(std::chrono::steady_clock::now().time_since_epoch().count())
+{
+}
+
+void WildcardDetector::count(const DNSQuestion &q)
+{
+	const std::string key = parentKey(q);
+	if(key.empty())
+		return;
+	MutexAutoLock alock(mtx);
+	counts[key]++;
+}
+
+bool WildcardDetector::hold(QueryID id, const DNSQuestion &q)
+{
+	const std::string key = parentKey(q);
+	if(key.empty())
+		return false;
+	MutexAutoLock alock(mtx);
+	auto it = parents.find(key);
+	if(it == parents.end()) {
+		auto c = counts.find(key);
+		if(c == counts.end() || c->second < WILDCARD_MIN_QUERIES)
+			return false;
+
+		DNSQuestion p = q;
+		p.name.labels[0] = randomLabel();
+		Parent parent;
+		parent.state = PROBING;
+		parent.probe = first_probe + probes.size();
+		probes.push_back(p);
+		probe_parents.push_back(key);
+		new_probes.push_back(parent.probe);
+		it = parents.emplace(key, parent).first;
+	}
+	if(it->second.state != PROBING)
+		return false;
+	it->second.held.push_back(id);
+	return true;
+}
+
+void WildcardDetector::takeProbes(std::vector<QueryID> *res)
+{
+	MutexAutoLock alock(mtx);
+	res->insert(res->end(), new_probes.begin(), new_probes.end());
+	new_probes.clear();
+}
+
+DNSQuestion WildcardDetector::probe(QueryID id)
+{
+	MutexAutoLock alock(mtx);
+	return probes.at(id - first_probe);
+}
+
+void WildcardDetector::finishProbe(QueryID id, const DNSPacket *pkt,
+	std::vector<QueryID> *released, bool *wildcard)
+{
+	MutexAutoLock alock(mtx);
+	Parent &parent = parents.at(probe_parents.at(id - first_probe));
+	// a random name shouldn't exist, if it has records they're from a wildcard
+	parent.state = NONE;
+	if(pkt && pkt->rcode() == DNS_RCODE_NOERROR && !pkt->answers.empty()) {
+		parent.state = WILDCARD;
+		for(auto &a : pkt->answers)
+			parent.records.insert(recordKey(a));
+		n_wildcards++;
+	}
+	*wildcard = parent.state == WILDCARD;
+	released->swap(parent.held);
+	parent.held.clear();
+	parent.held.shrink_to_fit();
+}
+
+bool WildcardDetector::matches(const DNSQuestion &q, const DNSPacket &pkt)
+{
+	const std::string key = parentKey(q);
+	if(key.empty() || pkt.answers.empty())
+		return false;
+	MutexAutoLock alock(mtx);
+	auto it = parents.find(key);
+	if(it == parents.end() || it->second.state != WILDCARD)
+		return false;
+	for(auto &a : pkt.answers) {
+		if(it->second.records.count(recordKey(a)) == 0)
+			return false;
+	}
+	return true;
+}
+
+size_t WildcardDetector::wildcardCount()
+{
+	MutexAutoLock alock(mtx);
+	return n_wildcards;
+}
+
+std::string WildcardDetector::parentKey(const DNSQuestion &q)
+{
+	// wildcards directly below the root or a TLD aren't a thing
+	if(q.name.labels.size() < 3)
+		return "";
+	DNSName parent;
+	parent.labels.assign(q.name.labels.begin() + 1, q.name.labels.end());
+	return AnswerCache::key(parent, q.qtype, q.qclass);
+}
+
+// the record without its owner name and TTL
+std::string WildcardDetector::recordKey(const DNSAnswer &a)
+{
+	DNSAnswer tmp = a;
+	tmp.name = DNSName();
+	tmp.ttl = 0;
+	return tmp.toString();
+}
+
+std::string WildcardDetector::randomLabel()
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+	std::string ret;
+	for(int i = 0; i < 16; i++)
+		ret += chars[rng() % (sizeof(chars) - 1)];
+	return ret;
+}
@@ -0,0 +1,450 @@
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_ether.h>
+#include <fstream>
+#include <sstream>
+
+#include "xdp.hpp"
+
+// Ethernet + IPv4 (without options) + UDP
+#define HEADERS_SIZE 42
+
+static inline void put_u16(unsigned char *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static inline uint16_t get_u16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint16_t ipv4_checksum(const unsigned char *hdr)
+{
+	uint32_t sum = 0;
+	for(int i = 0; i < 20; i += 2)
+		sum += get_u16(&hdr[i]);
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static inline uint32_t load_acquire(const uint32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(uint32_t *p, uint32_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static inline struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn i;
+	i.code = code;
+	i.dst_reg = dst;
+	i.src_reg = src;
+	i.off = off;
+	i.imm = imm;
+	return i;
+}
+
+// as the kernel currently uses, i.e. the combined channels set with ethtool -L
+static unsigned rx_queue_count(const std::string &ifname)
+{
+	DIR *d = opendir(("/sys/class/net/" + ifname + "/queues").c_str());
+	if(!d)
+		return 1;
+	unsigned n = 0;
+	while(struct dirent *e = readdir(d))
+		n += strncmp(e->d_name, "rx-", 3) == 0 ? 1 : 0;
+	closedir(d);
+	return n;
+}
+
+XdpSocket::~XdpSocket()
+{
+	// closing the link detaches the program
+	for(int f : { link_fd, prog_fd, map_fd, fd, port_fd }) {
+		if(f != -1)
+			::close(f);
+	}
+	for(Ring *r : { &fill, &comp, &rx, &tx }) {
+		if(r->map)
+			munmap(r->map, r->map_size);
+	}
+	if(umem)
+		munmap(umem, (size_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE);
+}
+
+bool XdpSocket::fail(const std::string &what)
+{
+	error = what;
+	return false;
+}
+
+bool XdpSocket::sysFail(const char *call)
+{
+	error = std::string(call) + ": " + strerror(errno);
+	return false;
+}
+
+bool XdpSocket::open(const std::string &ifname, unsigned queue)
+{
+	this->ifname = ifname;
+	ifindex = if_nametoindex(ifname.c_str());
+	if(ifindex == 0)
+		return fail("Unknown interface " + ifname);
+	// the program hands replies to the socket of the queue they arrive on,
+	// with only one socket those on other queues would be lost silently
+	const unsigned n_queues = rx_queue_count(ifname);
+	if(n_queues > 1) {
+		return fail("Interface " + ifname + " has " + std::to_string(n_queues) +
+			" receive queues, reduce it to one with `ethtool -L " + ifname + " combined 1`");
+	}
+	{
+		int s = socket(AF_INET, SOCK_DGRAM, 0);
+		struct ifreq ifr;
+		memset(&ifr, 0, sizeof(ifr));
+		strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+		bool ok = ioctl(s, SIOCGIFHWADDR, &ifr) == 0;
+		memcpy(local_mac, ifr.ifr_hwaddr.sa_data, 6);
+		ok = ok && ioctl(s, SIOCGIFADDR, &ifr) == 0;
+		local_ip = ((struct sockaddr_in*) &ifr.ifr_addr)->sin_addr.s_addr;
+		::close(s);
+		if(!ok)
+			return fail("Interface " + ifname + " has no IPv4 address");
+	}
+
+	// keep the port reserved so that nobody else uses it
+	{
+		port_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		socklen_t addrlen = sizeof(addr);
+		if(port_fd == -1 || bind(port_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+			getsockname(port_fd, (struct sockaddr*) &addr, &addrlen) != 0)
+			return sysFail("bind");
+		local_port = ntohs(addr.sin_port);
+	}
+
+	void *p = mmap(NULL, (size_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+		return sysFail("mmap");
+	umem = (unsigned char*) p;
+
+	fd = socket(AF_XDP, SOCK_RAW, 0);
+	if(fd == -1)
+		return sysFail("socket(AF_XDP)");
+	struct xdp_umem_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uintptr_t) umem;
+	reg.len = (uint64_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	if(setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0)
+		return sysFail("XDP_UMEM_REG");
+	int ring_size = XDP_RING_SIZE;
+	for(int opt : { XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING }) {
+		if(setsockopt(fd, SOL_XDP, opt, &ring_size, sizeof(ring_size)) != 0)
+			return sysFail("setsockopt(SOL_XDP)");
+	}
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	if(getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0)
+		return sysFail("XDP_MMAP_OFFSETS");
+	if(!mapRing(fill, off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+		!mapRing(comp, off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)) ||
+		!mapRing(rx, off.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc)) ||
+		!mapRing(tx, off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc)))
+		return sysFail("mmap");
+
+	// the kernel gets all receive frames right away
+	uint64_t *addrs = (uint64_t*) fill.descs;
+	for(uint32_t i = 0; i < XDP_NUM_FRAMES / 2; i++)
+		addrs[i] = (uint64_t) i * XDP_FRAME_SIZE;
+	store_release(fill.producer, XDP_NUM_FRAMES / 2);
+	for(uint32_t i = XDP_NUM_FRAMES / 2; i < XDP_NUM_FRAMES; i++)
+		free_tx.push_back((uint64_t) i * XDP_FRAME_SIZE);
+
+	struct sockaddr_xdp sxdp;
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = queue;
+	sxdp.sxdp_flags = XDP_COPY;
+	if(bind(fd, (struct sockaddr*) &sxdp, sizeof(sxdp)) != 0)
+		return sysFail("bind(AF_XDP)");
+
+	return loadProgram(queue);
+}
+
+bool XdpSocket::mapRing(Ring &r, const struct xdp_ring_offset &off, uint64_t pgoff, size_t desc_size)
+{
+	r.map_size = off.desc + XDP_RING_SIZE * desc_size;
+	void *p = mmap(NULL, r.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if(p == MAP_FAILED)
+		return false;
+	r.map = p;
+	unsigned char *base = (unsigned char*) p;
+	r.producer = (uint32_t*) (base + off.producer);
+	r.consumer = (uint32_t*) (base + off.consumer);
+	r.descs = base + off.desc;
+	r.mask = XDP_RING_SIZE - 1;
+	return true;
+}
+
+bool XdpSocket::loadProgram(unsigned queue)
+{
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = 4;
+	attr.value_size = 4;
+	attr.max_entries = queue + 1;
+	map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if(map_fd == -1)
+		return sysFail("BPF_MAP_CREATE");
+
+	// IPv4 UDP packets to our port go to the socket of their queue,
+	// everything else (or if there's no socket) to the kernel
+	const struct bpf_insn prog[] = {
+		insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0), // r6 = ctx
+		insn(BPF_LDX | BPF_MEM | BPF_W, 2, 1, 0, 0), // r2 = ctx->data
+		insn(BPF_LDX | BPF_MEM | BPF_W, 3, 1, 4, 0), // r3 = ctx->data_end
+		insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, HEADERS_SIZE),
+		insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 14, 0), // too short
+		insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),
+		insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 12, htons(ETH_P_IP)),
+		insn(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0),
+		insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 10, 0x45), // IPv4 without options
+		insn(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0),
+		insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 8, IPPROTO_UDP),
+		insn(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 36, 0),
+		insn(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 6, htons(local_port)),
+		insn(BPF_LDX | BPF_MEM | BPF_W, 2, 6, 16, 0), // r2 = ctx->rx_queue_index
+		insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+		insn(0, 0, 0, 0, 0),
+		insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	static const char license[] = "GPL";
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t) prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (uintptr_t) license;
+	prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if(prog_fd == -1)
+		return sysFail("BPF_PROG_LOAD");
+
+	uint32_t key = queue, value = fd;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uintptr_t) &key;
+	attr.value = (uintptr_t) &value;
+	attr.flags = BPF_ANY;
+	if(sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0)
+		return sysFail("BPF_MAP_UPDATE_ELEM");
+
+	// native mode if the driver supports it, generic mode otherwise
+	for(uint32_t flags : { 0U, (uint32_t) XDP_FLAGS_SKB_MODE }) {
+		memset(&attr, 0, sizeof(attr));
+		attr.link_create.prog_fd = prog_fd;
+		attr.link_create.target_ifindex = ifindex;
+		attr.link_create.attach_type = BPF_XDP;
+		attr.link_create.flags = flags;
+		link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+		if(link_fd != -1)
+			return true;
+	}
+	return sysFail("BPF_LINK_CREATE");
+}
+
+bool XdpSocket::addDestination(const SocketAddress &addr)
+{
+	if(!IN6_IS_ADDR_V4MAPPED(&addr.addr.sin6_addr))
+		return fail(addr.toString() + " is not an IPv4 address");
+	uint32_t ip;
+	memcpy(&ip, &addr.addr.sin6_addr.s6_addr[12], 4);
+
+	// most specific route through our interface
+	uint32_t gateway = 0;
+	int best = -1;
+	std::ifstream routes("/proc/net/route");
+	std::string line;
+	std::getline(routes, line); // header
+	while(std::getline(routes, line)) {
+		std::istringstream iss(line);
+		std::string iface;
+		uint32_t r_dest, r_gateway, r_mask;
+		unsigned flags, refcnt, use, metric;
+		iss >> iface >> std::hex >> r_dest >> r_gateway >> flags >> std::dec
+			>> refcnt >> use >> metric >> std::hex >> r_mask;
+		if(!iss || iface != ifname || (ip & r_mask) != r_dest)
+			continue;
+		int bits = __builtin_popcount(r_mask);
+		if(bits > best) {
+			best = bits;
+			gateway = r_gateway;
+		}
+	}
+	if(best < 0)
+		return fail("No route to " + addr.toString() + " via " + ifname);
+
+	const uint32_t hop = gateway != 0 ? gateway : ip;
+	std::ifstream arp("/proc/net/arp");
+	std::getline(arp, line); // header
+	while(std::getline(arp, line)) {
+		std::istringstream iss(line);
+		std::string a_ip, a_type, a_flags, a_mac, a_mask, a_dev;
+		iss >> a_ip >> a_type >> a_flags >> a_mac >> a_mask >> a_dev;
+		struct in_addr a;
+		if(a_dev != ifname || inet_pton(AF_INET, a_ip.c_str(), &a) != 1 || a.s_addr != hop)
+			continue;
+		std::vector<unsigned char> mac(6);
+		if((strtoul(a_flags.c_str(), NULL, 16) & 0x2) == 0 || sscanf(a_mac.c_str(),
+			"%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6)
+			continue;
+		next_hop[ip] = mac;
+		return true;
+	}
+	return fail("No neighbour entry for the next hop to " + addr.toString() + " (try pinging it first)");
+}
+
+void XdpSocket::sendto(const ustring &data, const SocketAddress &host)
+{
+	uint32_t dst_ip;
+	memcpy(&dst_ip, &host.addr.sin6_addr.s6_addr[12], 4);
+	auto it = next_hop.find(dst_ip);
+	if(it == next_hop.end() || data.size() > XDP_FRAME_SIZE - HEADERS_SIZE)
+		return; // dropped, the query will time out
+
+	uint32_t prod = *tx.producer;
+	while(1) {
+		reclaimTx();
+		if(!free_tx.empty() && prod - load_acquire(tx.consumer) < XDP_RING_SIZE)
+			break;
+		kick();
+		sched_yield();
+	}
+	const uint64_t addr = free_tx.back();
+	free_tx.pop_back();
+
+	unsigned char *f = umem + addr;
+	memcpy(&f[0], it->second.data(), 6);
+	memcpy(&f[6], local_mac, 6);
+	put_u16(&f[12], ETH_P_IP);
+	unsigned char *ip = &f[14];
+	memset(ip, 0, 20);
+	ip[0] = 0x45;
+	put_u16(&ip[2], 28 + data.size());
+	put_u16(&ip[4], ip_id++);
+	ip[6] = 0x40; // DF
+	ip[8] = 64; // TTL
+	ip[9] = IPPROTO_UDP;
+	memcpy(&ip[12], &local_ip, 4);
+	memcpy(&ip[16], &dst_ip, 4);
+	put_u16(&ip[10], ipv4_checksum(ip));
+	unsigned char *udp = &ip[20];
+	put_u16(&udp[0], local_port);
+	put_u16(&udp[2], host.getPort());
+	put_u16(&udp[4], 8 + data.size());
+	put_u16(&udp[6], 0); // no checksum
+	memcpy(&udp[8], data.c_str(), data.size());
+
+	struct xdp_desc &d = ((struct xdp_desc*) tx.descs)[prod & tx.mask];
+	d.addr = addr;
+	d.len = HEADERS_SIZE + data.size();
+	d.options = 0;
+	store_release(tx.producer, prod + 1);
+	// copy mode always needs a syscall to send
+	kick();
+}
+
+void XdpSocket::recvfrom(size_t n, ustring *data, struct SocketAddress &source)
+{
+	data->clear();
+	const uint32_t cons = *rx.consumer;
+	if(cons == load_acquire(rx.producer))
+		return;
+	const struct xdp_desc d = ((struct xdp_desc*) rx.descs)[cons & rx.mask];
+	const unsigned char *f = umem + d.addr;
+	if(d.len >= HEADERS_SIZE) {
+		const unsigned char *ip = &f[14];
+		const size_t udp_len = get_u16(&ip[24]);
+		if(udp_len >= 8 && 34 + udp_len <= d.len) {
+			struct in_addr a;
+			memcpy(&a, &ip[12], 4);
+			source.setIPv4(a);
+			source.setPort(get_u16(&ip[20]));
+			data->assign(&f[HEADERS_SIZE], std::min(udp_len - 8, n));
+		}
+	}
+
+	// the frame goes back to the kernel, there's always room in the fill ring
+	const uint32_t prod = *fill.producer;
+	((uint64_t*) fill.descs)[prod & fill.mask] = d.addr & ~((uint64_t) XDP_FRAME_SIZE - 1);
+	store_release(fill.producer, prod + 1);
+	store_release(rx.consumer, cons + 1);
+}
+
+short XdpSocket::poll(short events, int timeout)
+{
+	if(closed)
+		return POLLNVAL;
+	if(load_acquire(rx.producer) != *rx.consumer)
+		return POLLIN;
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	if(::poll(&pfd, 1, timeout) == -1)
+		throw SocketException();
+	if(closed)
+		return POLLNVAL;
+	return pfd.revents & POLLIN;
+}
+
+void XdpSocket::close()
+{
+	closed = true;
+}
+
+void XdpSocket::reclaimTx()
+{
+	uint32_t cons = *comp.consumer;
+	const uint32_t prod = load_acquire(comp.producer);
+	if(cons == prod)
+		return;
+	for(; cons != prod; cons++)
+		free_tx.push_back(((uint64_t*) comp.descs)[cons & comp.mask]);
+	store_release(comp.consumer, cons);
+}
+
+void XdpSocket::kick()
+{
+	// errors only mean that the kernel is busy, it'll pick the frames up later
+	::sendto(fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}